@@ -30,6 +30,7 @@
 #include "key.h"
 #include "midi.h"
 #include "eeprom.h"
+#include "fastrgb.h"
 
 
 // SysEx command constants
@@ -222,6 +223,16 @@ void sysExCmdSystem (uint16_t length, uint8_t* buffer)
 			//while(true){}; // !review: Force Reset (why? when you could just call load_default_settings?)
         }
         break;
+    case 3:
+        {
+            // Select the NoteOn feedback palette (FASTRGB_PALETTE_*). Unknown
+            // modes are ignored, and re-selecting the current one doesn't
+            // spend an EEPROM write.
+            if (length > 1 && buffer[1] <= FASTRGB_PALETTE_USER && buffer[1] != G_EE_PALETTE_MODE) {
+                eeprom_write(EE_PALETTE_MODE, G_EE_PALETTE_MODE = buffer[1]);
+            }
+        }
+        break;
     default:
         break;
     }
@@ -254,9 +265,11 @@ Bulk Transfer Protocol:
 
 
 This implementation is hard coded to support only a subset of the protocol:
-    - Only two tags are supported:
+    - Only three tags are supported:
         0x1     Idle button color data
         0x2     Active button color data
+        0x3     User velocity palette, 6-bit r g b per entry, 8 entries per part
+                (push only; stored at 4 bits per channel)
 
 NOTE: Binary data must either avoid setting the MSB, or encode octets as packed septets, as MIDI will interpret octets with the MSB set as special SysEx commands.
 
@@ -281,6 +294,16 @@ void sysExCmdBulkXfer(uint16_t length, uint8_t* buffer)
 				if (part > 16) { // NUM_BUTTONS*NUM_BANKS/8 - > 8 buttons of led data per 24 bytes
 					return;
 				}
+
+				if (tag == 3) { // 128 palette entries / 8 per part
+				    wdt_disable();
+				    uint8_t v = (part-1) * 8;
+				    for (uint8_t i = 0; i+2 < size && i < 24; i+=3) { // 8 entries per part
+				        fastrgb_user_palette_write(v++, buffer[i], buffer[i+1], buffer[i+2]);
+				    }
+				    wdt_enable(WDTO_2S);
+				    return;
+				}
 				
 				uint8_t bank = (part-1) >> 3; // 0 or 1 (8 parts per bank)
 				uint8_t offset = ((part-1) & 0x07) * 24; // 0to7 * 24 -> to base position
@@ -361,7 +384,7 @@ void sysExCmdBulkXfer(uint16_t length, uint8_t* buffer)
                 
                 // Send the message
                 midi_stream_sysex(11 + size, payload);
-				MIDI_Device_Flush(g_midi_interface_info); // MIDI_Device_USBTask calls flush, but has redundant checks that we are avoiding.
+				midi_flush_wait(); // the whole dump is bigger than the transmit queue
             }
         }
     }
@@ -36,22 +36,106 @@
 #define USB_RX_ONCE_PER_MAINLOOP 0
 // !review: remove periodically as an option or improve it so it's as good or better than the alternative?
 #define USB_RX_PERIODICALLY 1 // 100+ times throughout main loop
-#define USB_RX_METHOD USB_RX_ONCE_PER_MAINLOOP
+#define USB_RX_INTERRUPT 2 // OUT endpoint ISR fills a ring buffer, main loop drains it without polling
+#define USB_RX_METHOD USB_RX_INTERRUPT
 // - How many packets to look for per iteration
-#if USB_RX_METHOD < USB_RX_PERIODICALLY
-#define USB_RX_FAIL_LIMIT 120
-#define USB_RX_PACKET_LIMIT 512
-#else
+#if USB_RX_METHOD == USB_RX_PERIODICALLY
 #define USB_RX_FAIL_LIMIT 160
 #define USB_RX_PACKET_LIMIT 2
+#else
+#define USB_RX_FAIL_LIMIT 120
+#define USB_RX_PACKET_LIMIT 512
+#endif
+// - Interrupt receive ring, in USB-MIDI events (must be a power of two, <= 128)
+// -- Two full OUT banks. When a bank doesn't fit it stays in the endpoint and
+// -- the host is NAKed until the main loop drains the ring, so nothing is lost
+#define USB_RX_RING_SIZE 32
+
+// - USB Start-of-Frame scheduler: start one main loop per 1ms USB frame
+// -- Work is tied to the bus schedule rather than a receive spin count. Any
+// -- packet that isn't waiting when the receive slot runs is picked up at
+// -- the start of the next frame, so the polled receive modes no longer spin.
+#define ENABLE_USB_SOF_SCHEDULER 1
+#if ENABLE_USB_SOF_SCHEDULER > 0
+#undef USB_RX_FAIL_LIMIT
+#define USB_RX_FAIL_LIMIT 1
 #endif
 
+// - Polled receive: read whole OUT banks (16 events) per driver call. Only
+// -- for USB_RX_ONCE_PER_MAINLOOP/USB_RX_PERIODICALLY, USB_RX_INTERRUPT already
+// -- copies whole banks in the endpoint ISR and can't be combined with it
 #define ENABLE_LUFA_2015_LARGE_PACKET_UPGRADE 0
 
+// - USB Transmit - stage outgoing events in RAM and commit them to the IN
+// -- endpoint with a single stream write (up to one 64 byte bank) in midi_flush()
+#define ENABLE_MIDI_TX_BATCHING 1
+// - USB Transmit - never block the main loop on the host. Events wait in a
+// -- queue until an IN bank is free; when the queue is full, redundant events
+// -- are merged and then the oldest channel voice event is dropped. SysEx is
+// -- never dropped to make room, it waits for the host instead, up to
+// -- MIDI_TX_FLUSH_TIMEOUT_MS (supersedes batching above)
+#define ENABLE_MIDI_TX_NONBLOCKING 1
+#define MIDI_TX_QUEUE_SIZE 16 // events, must be a power of two <= 128
+#define MIDI_TX_FLUSH_TIMEOUT_MS 100 // longest a send or midi_flush_wait() will stall (LUFA's stream timeout)
+
 // - MIDI Feedback
 #define ENABLE_NOTE_OFF_FEEDBACK_DELAY 2
 #define NOTE_OFF_FEEDBACK_DELAY_LIMIT 2 // !review: working value was 20, works at '1' with increased throughput, works at '2'
-#define DEBOUNCE_BUFFER_SIZE 10
+
+// - Pad Effects - NoteOns on the channels after the MIDI channel make a pad
+// -- flash (alternate with its static color every half beat) or pulse (one
+// --- brightness cycle per beat). Timed from display_flash_counter, so they
+// ---- follow MIDI clock when there is one. A static color cancels the effect.
+#define ENABLE_PAD_EFFECTS 1
+#define PAD_EFFECT_FLASH_CHANNEL_OFFSET 1
+#define PAD_EFFECT_PULSE_CHANNEL_OFFSET 2
+
+// - Pad Fades - lighting SysEx 0x2F fades a set of pads from their current
+// -- color to a target over a duration in ms or in display_flash_counter
+// --- steps (1/8 beat). The pads of one message share a slot, so up to
+// ---- PAD_FADE_SLOTS (max 8) different fades run at once
+#define ENABLE_PAD_FADES 1
+#define PAD_FADE_SLOTS 8
+
+// - Sequences - frames in the 0x5F format uploaded with lighting SysEx 0x1F
+// -- into a RAM store and played on the device, at a fixed fps or one frame
+// --- per display_flash_counter step (follows MIDI clock), once or looped
+// ---- off by default: the store and its state take about 280 bytes of RAM,
+// ----- the largest single user after the display buffer (scenes need it too)
+#define ENABLE_SEQUENCES 0
+#define SEQUENCE_STORE_BYTES 256
+
+// - Grid Transforms - lighting SysEx 0x0F shifts, scrolls, rotates or mirrors
+// -- the pads, or copies one 4x4 quadrant onto another, in drum rack geometry.
+// --- It also fills rectangles with a color or a gradient, so meters and
+// ---- faders take the same few bytes however many pads they cover
+#define ENABLE_GRID_TRANSFORMS 1
+
+// - Key Debounce - a key changes state once it has read the same for
+// -- DEBOUNCE_SAMPLES consecutive 1ms scans (max 15)
+#define DEBOUNCE_SAMPLES 10
+// - Eager: report a press on the first scan that sees it, debounce only the
+// -- release. 0 debounces both edges (a press is reported DEBOUNCE_SAMPLES ms late)
+#define ENABLE_KEY_DEBOUNCE_EAGER 1
+// - Key Events - the Timer0 ISR queues every debounced press/release, so taps
+// -- that start and end while the main loop is stalled still reach the host.
+// -- When the queue is full a key's change waits for room, it is never lost
+#define ENABLE_KEY_EVENT_QUEUE 1
+#define KEY_EVENT_QUEUE_SIZE 32 // events, must be a power of two <= 128
+#define KEY_EVENTS_PER_LOOP 8   // up to two MIDI events each, fits MIDI_TX_QUEUE_SIZE
+
+// - LED Output - clock the three PORTB strands (groups 0, 2, 3) out together,
+// -- one PORTB write per bit slot, then send group 1 (PORTC) on its own
+#define ENABLE_LED_PARALLEL_PORTB 1
+// - LED Push - how long interrupts stay off while the LEDs are sent
+#define LED_PUSH_ATOMIC 0     // the whole frame (about 4ms with four strands in a row)
+#define LED_PUSH_PER_STRAND 1 // one strand (or the three parallel PORTB strands) at a time
+#define LED_PUSH_MODE LED_PUSH_PER_STRAND
+// - LED Dirty Tracking - only send strands that changed, and only up to their
+// -- last changed button (WS2812s hold their color). Everything is re-sent
+// --- every LED_FULL_REFRESH_MS anyway, in case a strand ever misses a frame
+#define ENABLE_LED_DIRTY_TRACKING 1
+#define LED_FULL_REFRESH_MS 1000
 
 #define MIDI_FEEDBACK_MF3D_MODE 0  // 20 colors
 #define MIDI_FEEDBACK_ABLETON_MODE 1 // 15 2-bit dimable colors, 68 custom colors
@@ -62,6 +146,13 @@
 #define ENABLE_TEST_OUT_USB_RECEIVE 0
 #define ENABLE_TEST_OUT_NOTE_COUNTERS 0
 #define ENABLE_TEST_OUT_USB_PACKETS_PER_INTERVAL 0
+#define ENABLE_TEST_OUT_USB_RX_RING 0 // CC 10/11: ring overflow count, ring peak occupancy
+#define ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND 0 // CC 12/13: USB-MIDI events received / sent in the last second
+#define ENABLE_TEST_OUT_USB_FRAME_SCHEDULE 0 // CC 14/15: main loops / USB frames over the last ~1000 frames
+#define ENABLE_TEST_OUT_USB_TX_QUEUE 0 // CC 16/17: transmit events merged / dropped since power on
+#define ENABLE_TEST_OUT_USB_TX_MERGE 0 // CC 21: 0 if the transmit queue merge check at power on passed, else one bit per failed case
+#define ENABLE_TEST_OUT_KEY_SCAN_TIME 0 // CC 18: longest key scan ISR so far, in units of 256 cycles
+#define ENABLE_TEST_OUT_KEY_EVENT_QUEUE 0 // CC 19/20: scans that held a key change back for a full queue, longest wait in the queue (ms)
 #define ENABLE_TEST_IN_LED_CALIBRATION 0
 
 // CPU port constants ---------------------------------------------------------
@@ -129,7 +220,9 @@
 #define MIDI_BASENOTE              36  // Note number for the lowest key.
 #define MIDI_SIDE_BASENOTE         20  // Note number for the highest side key
 #define MIDI_MAX_NOTES            128  // Number of notes to track.
-#define MIDI_MAX_SYSEX            270  // max number of bytes in a valid sysex message.
+#define MIDI_MAX_SYSEX            140  // max number of bytes in a buffered (DJTT config) sysex message.
+// - lighting sysex (0x5F, 0x6F) is decoded as it streams in and has no limit
+// - largest buffered message is a bulk transfer part: 6 header + 127 data bytes
 
 // EEPROM constants -----------------------------------------------------------
 
@@ -161,11 +254,21 @@
 #define EE_PICK_SENSITIVITY      0x0016  // Sets the sensitivity of the pickup detection.
 #define EE_SLEEP_TIME            0x0017  // Sets time period (1 - 60 Minutes) for sleep timer, 0 to disable
 #define EE_SIDE_BANK             0x0018  // If enabled then side button number changes with bank
+#define EE_USER_PALETTE_B        0x0020  // User palette blue, 4-bit, two entries per byte, size = 64
+#define EE_PALETTE_MODE          0x0060  // NoteOn feedback palette, see FASTRGB_PALETTE_*
 
 #define EE_COLORS_IDLE			 0x006F  // Start of idle color map, size = 2*64*3
 #define EE_COLORS_ACTIVE		 0x01EF  // Start of active color map, size = 2*64*3
-#define EE_COLORS_LAST		 	 0x036F  // 0x018F is the next free EEPROM slot for use
+#define EE_COLORS_LAST		 	 0x036F  // 0x036F is the next free EEPROM slot for use
+#define EE_USER_PALETTE_RG_TAIL  0x036F  // User palette red/green for entries 112-127, size = 16
 #define EE_FACTORY_RESET_FLAG    0x038F  // Stores the EEPROM factory reset flag
+#define EE_USER_PALETTE_RG       0x0390  // User palette red/green, 4-bit each, entries 0-111, size = 112
+// - the 1KB EEPROM has no room for 128 * 18 bits, so user colors keep the top
+// -- 4 bits of each 6-bit channel
+// --- red/green is split around EE_FACTORY_RESET_FLAG, and with it fills most
+// ---- of the free space after EE_COLORS_LAST, the only room left for
+// ----- persistent lighting scenes, so those stay in RAM (see sequence.c) and
+// ------ are lost at power off
     
 // Device Output Modes
 #define MIDI_OUTPUT_MODE_NOTES_ONLY  0x00
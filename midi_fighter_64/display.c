@@ -31,6 +31,7 @@
 #include "random.h"
 #include "display.h"
 #include "idle.h"
+#include "sequence.h"
 //#include "accel_gyro.h"
 #include "led.h"
 #include "eeprom.h"
@@ -38,9 +39,13 @@
 
 // Globals --------------------------------------------------------------------
 
-// Storage for the LED state
+// Storage for the LED state. This is the canonical pad state, written by the
+// fastrgb_* setters in the order the LED driver sends it (B, R, G per
+// button), so a frame with no overlay goes out with no copy at all.
 uint8_t g_display_buffer[64 * 3]; // This can be reduced to 64: we are treating two leds as one since they refer to a single button
 // - other storage !review
+uint8_t g_display_dirty[DISPLAY_STRANDS]; // buttons to send per strand, see display_mark_dirty()
+static bool display_overlay_active = false; // idle or geometric animation drew last frame
 
 // Prototypes -----------------------------------------------------------------
 
@@ -53,7 +58,7 @@ void back_fade(const uint8_t value, uint8_t *buffer);
 
 // This array holds the default colors, matched to those in the utility
 
-const uint8_t default_color[20][3] = { // This array is used to remap sysex rgb values in to a small subset of colors.
+const uint8_t default_color[20][3] PROGMEM = { // This array is used to remap sysex rgb values in to a small subset of colors.
 	// Listed as RGB but actual order that this is sent to the led controller is BRG
 	{0x00,0x00,0x00},   // 0: Off 
 	{48,0x00,0x00},		// Red
@@ -156,11 +161,19 @@ void geometric_animation_state(uint8_t *buffer) {
 
 // Geometric Triangle Animation (end)
 
-void fastrgb_state(uint8_t* buffer) {
-	for (uint8_t i=0; i<NUM_BUTTONS; i++) {
-		buffer[i * 3 + 0] = g_fastrgb_state[i][2];
-		buffer[i * 3 + 1] = g_fastrgb_state[i][0];
-		buffer[i * 3 + 2] = g_fastrgb_state[i][1];
+// Button 'button_id' has a new color, make sure the next push reaches it.
+void display_mark_dirty(uint8_t button_id)
+{
+	uint8_t end = (button_id & 0x0F) + 1;
+	if (g_display_dirty[button_id >> 4] < end) {
+		g_display_dirty[button_id >> 4] = end;
+	}
+}
+
+void display_mark_all_dirty(void)
+{
+	for (uint8_t strand=0; strand<DISPLAY_STRANDS; strand++) {
+		g_display_dirty[strand] = 16;
 	}
 }
 
@@ -168,9 +181,14 @@ void fastrgb_state(uint8_t* buffer) {
 
 void default_display_run(void)
 {
-	// allow the user to write colors using MIDI input.
-	fastrgb_state(g_display_buffer);
-	
+	#if ENABLE_LED_DIRTY_TRACKING > 0
+	static uint32_t last_full_refresh_time_ms = 0;
+	if (system_time_ms - last_full_refresh_time_ms >= LED_FULL_REFRESH_MS) {
+		last_full_refresh_time_ms = system_time_ms;
+		display_mark_all_dirty();
+	}
+	#endif
+
 	// Sleep Animation
 	// Increment timing counters
 	if (half_ms_counter >= 2000)
@@ -210,15 +228,97 @@ void default_display_run(void)
 			idle_init();
 			sleep_minute_counter++;
 		}
-		if (sleep_minute_counter > G_EE_SLEEP_TIME) {
-			idle_tick(g_display_buffer);
-		}
-		if (g_key_down) {
+		if (g_key_down_rows) {
 			one_second_counter = 0;
 			sleep_minute_counter = 0;
 		}
 	}
-	geometric_animation_state(g_display_buffer);
+}
+
+// Send a frame in which only the dirty strands changed.
+static void display_send(uint8_t* frame)
+{
+	#if ENABLE_LED_DIRTY_TRACKING > 0
+	// The overlay is gone, put the pad colors back everywhere it drew.
+	if (display_overlay_active) {
+		display_overlay_active = false;
+		display_mark_all_dirty();
+	}
+	// Take this frame's dirty counts and start collecting the next frame's.
+	uint8_t buttons[DISPLAY_STRANDS];
+	for (uint8_t strand=0; strand<DISPLAY_STRANDS; strand++) {
+		buttons[strand] = g_display_dirty[strand];
+		g_display_dirty[strand] = 0;
+	}
+	led_update_strands(frame, buttons);
+	#else
+	display_overlay_active = false;
+	led_update_pixels(frame);
+	#endif
+}
+
+// The scratch frames live in these two, kept out of display_push() so their
+// 192 bytes are only on the stack while something is drawn over the pads.
+static __attribute__((noinline)) void display_push_overlay(bool idle)
+{
+	uint8_t scratch[sizeof(g_display_buffer)];
+
+	if (idle) {
+		idle_tick(scratch); // covers the whole frame
+	} else {
+		memcpy(scratch, g_display_buffer, sizeof(scratch));
+		#if ENABLE_PAD_EFFECTS > 0
+		if (fastrgb_effects_tick()) fastrgb_effects_render(scratch);
+		#endif
+	}
+	geometric_animation_state(scratch);
+	led_update_pixels(scratch);
+	display_overlay_active = true;
+}
+
+#if ENABLE_PAD_EFFECTS > 0
+static __attribute__((noinline)) void display_push_effects(void)
+{
+	uint8_t scratch[sizeof(g_display_buffer)];
+
+	memcpy(scratch, g_display_buffer, sizeof(scratch));
+	fastrgb_effects_render(scratch);
+	display_send(scratch);
+}
+#endif
+
+// Send this frame to the LEDs.
+//
+// While the idle animation or the geometric animation is running they are
+// drawn over a copy of the pad colors in a scratch buffer on the stack, and
+// the whole frame is sent from there. Pad effects are drawn over a copy too.
+// The rest of the time the pad colors go out straight from g_display_buffer,
+// with no scratch buffer at all; with ENABLE_LED_DIRTY_TRACKING only the
+// strands that changed are sent, each only up to its last changed button.
+//
+void display_push(void)
+{
+	#if ENABLE_SEQUENCES > 0
+	sequence_tick();
+	#endif
+	#if ENABLE_PAD_FADES > 0
+	fastrgb_fades_tick();
+	#endif
+
+	bool idle = G_EE_SLEEP_TIME && sleep_minute_counter > G_EE_SLEEP_TIME;
+	if (idle || geometric_animation_pos < GEOMETRIC_ANIMATION_STEPS) {
+		display_push_overlay(idle);
+		return;
+	}
+
+	#if ENABLE_PAD_EFFECTS > 0
+	if (fastrgb_effects_tick()) {
+		display_push_effects();
+		return;
+	}
+	#endif
+
+	display_send(g_display_buffer);
 }
 
 #define LAVENDER_GREEN_LIMIT 0x24 // Can't be lavender if it has a lot of green (MF3D Patch)
@@ -241,18 +341,18 @@ void adjust_inactive_bank_leds_for_power(uint8_t* rgb)
 				id = COLORID_OFF;
 			}
 			else { // BLUE
-				if (rgb[2] == default_color[COLORID_BLUE][2]) {return;} // Patch: do not change if already assigned as MF64 Color
+				if (rgb[2] == pgm_read_byte(&default_color[COLORID_BLUE][2])) {return;} // Patch: do not change if already assigned as MF64 Color
 				id = rgb[2] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_BLUE : COLORID_BLUE_DIM;
 			}
 		}
 		else if (!rgb[2]) // GREEN only (no red no blue)
 		{
-			if (rgb[1] == default_color[COLORID_GREEN][1]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[1] == pgm_read_byte(&default_color[COLORID_GREEN][1])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_GREEN : COLORID_GREEN_DIM;
 		}
 		else  // No Red, Yes Green, Yes Blue: CYAN
 		{
-			if (rgb[1] == default_color[COLORID_CYAN][1]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[1] == pgm_read_byte(&default_color[COLORID_CYAN][1])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CYAN : COLORID_CYAN_DIM;
 		}
 	}
@@ -260,12 +360,12 @@ void adjust_inactive_bank_leds_for_power(uint8_t* rgb)
 	{
 		if (!rgb[2]) // RED ONLY
 		{
-			if (rgb[0] == default_color[COLORID_RED][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_RED][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_RED : COLORID_RED_DIM;
 		}
 		else // Red and Blue (PINK) Note Lavender has some green in it
 		{
-			if (rgb[0] == default_color[COLORID_PINK][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_PINK][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_PINK : COLORID_PINK_DIM;
 		}
 	}
@@ -274,17 +374,17 @@ void adjust_inactive_bank_leds_for_power(uint8_t* rgb)
 		// Yellow, Orange, or Chartreuse (rx midi (value is *2) chart:5f,7f,00, yellow: 7f,5f,00, orange: 7f,22,00)
 		if (rgb[0] < rgb[1]) // CHARTRUESE: more green than red 
 		{
-			if (rgb[1] == default_color[COLORID_CHARTREUSE][1]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[1] == pgm_read_byte(&default_color[COLORID_CHARTREUSE][1])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CHARTREUSE : COLORID_CHARTREUSE_DIM;
 		}
 		else if (rgb[0] >> 1 >= rgb[1]) // ORANGE: more than twice as much red as green
 		{
-			if (rgb[0] == default_color[COLORID_ORANGE][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_ORANGE][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_ORANGE : COLORID_ORANGE_DIM;				
 		}
 		else // YELLOW 
 		{
-			if (rgb[0] == default_color[COLORID_YELLOW][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_YELLOW][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_YELLOW : COLORID_YELLOW_DIM;
 		}
 	}
@@ -295,13 +395,13 @@ void adjust_inactive_bank_leds_for_power(uint8_t* rgb)
 		}
 		else { // Lavender
 			// - If blue is bright, assume lavendar is intended to be bright
-			if (rgb[2] == default_color[COLORID_LAVENDER][2]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[2] == pgm_read_byte(&default_color[COLORID_LAVENDER][2])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_LAVENDER : COLORID_LAVENDER_DIM;			
 		}
 	}
-	rgb[0] = default_color[id][0];
-	rgb[1] = default_color[id][1];
-	rgb[2] = default_color[id][2];
+	rgb[0] = pgm_read_byte(&default_color[id][0]);
+	rgb[1] = pgm_read_byte(&default_color[id][1]);
+	rgb[2] = pgm_read_byte(&default_color[id][2]);
 }
 void adjust_active_bank_leds_for_power(uint8_t* rgb)
 {
@@ -314,18 +414,18 @@ void adjust_active_bank_leds_for_power(uint8_t* rgb)
 				id = COLORID_OFF;
 			}
 			else { // BLUE
-				if (rgb[2] == default_color[COLORID_BLUE][2]) {return;} // Patch: do not change if already assigned as MF64 Color
+				if (rgb[2] == pgm_read_byte(&default_color[COLORID_BLUE][2])) {return;} // Patch: do not change if already assigned as MF64 Color
 				id = rgb[2] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_BLUE : COLORID_BLUE_DIM;
 			}
 		}
 		else if (!rgb[2]) // GREEN only (no red no blue)
 		{
-			if (rgb[1] == default_color[COLORID_GREEN][1]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[1] == pgm_read_byte(&default_color[COLORID_GREEN][1])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_GREEN : COLORID_GREEN_DIM;
 		}
 		else  // No Red, Yes Green, Yes Blue: CYAN
 		{
-			if (rgb[1] == default_color[COLORID_CYAN][1]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[1] == pgm_read_byte(&default_color[COLORID_CYAN][1])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CYAN : COLORID_CYAN_DIM;
 		}
 	}
@@ -333,12 +433,12 @@ void adjust_active_bank_leds_for_power(uint8_t* rgb)
 	{
 		if (!rgb[2]) // RED ONLY
 		{
-			if (rgb[0] == default_color[COLORID_RED][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_RED][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_RED : COLORID_RED_DIM;
 		}
 		else // Red and Blue (PINK) Note Lavender has some green in it
 		{
-			if (rgb[0] == default_color[COLORID_PINK][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_PINK][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_PINK : COLORID_PINK_DIM;
 		}
 	}
@@ -347,17 +447,17 @@ void adjust_active_bank_leds_for_power(uint8_t* rgb)
 		// Yellow, Orange, or Chartreuse (rx midi (value is *2) chart:5f,7f,00, yellow: 7f,5f,00, orange: 7f,22,00)
 		if (rgb[0] < rgb[1]) // CHARTRUESE: more green than red 
 		{
-			if (rgb[1] == default_color[COLORID_CHARTREUSE][1]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[1] == pgm_read_byte(&default_color[COLORID_CHARTREUSE][1])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CHARTREUSE : COLORID_CHARTREUSE_DIM;
 		}
 		else if (rgb[0] >> 1 >= rgb[1]) // ORANGE: more than twice as much red as green
 		{
-			if (rgb[0] == default_color[COLORID_ORANGE][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_ORANGE][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_ORANGE : COLORID_ORANGE_DIM;				
 		}
 		else // YELLOW 
 		{
-			if (rgb[0] == default_color[COLORID_YELLOW][0]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[0] == pgm_read_byte(&default_color[COLORID_YELLOW][0])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_YELLOW : COLORID_YELLOW_DIM;
 		}
 	}
@@ -368,11 +468,11 @@ void adjust_active_bank_leds_for_power(uint8_t* rgb)
 		}
 		else { // Lavender
 			// - If blue is bright, assume lavendar is intended to be bright
-			if (rgb[2] == default_color[COLORID_LAVENDER][2]) {return;} // Patch: do not change if already assigned as MF64 Color
+			if (rgb[2] == pgm_read_byte(&default_color[COLORID_LAVENDER][2])) {return;} // Patch: do not change if already assigned as MF64 Color
 			id = rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_LAVENDER : COLORID_LAVENDER_DIM;			
 		}
 	}
-	rgb[0] = default_color[id][0];
-	rgb[1] = default_color[id][1];
-	rgb[2] = default_color[id][2];
+	rgb[0] = pgm_read_byte(&default_color[id][0]);
+	rgb[1] = pgm_read_byte(&default_color[id][1]);
+	rgb[2] = pgm_read_byte(&default_color[id][2]);
 }
\ No newline at end of file
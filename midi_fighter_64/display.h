@@ -25,6 +25,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <avr/pgmspace.h>
 
 // Constants ------------------------------------------------------------------
 #define SIXTEENTH_FLASH_STATE   0x01
@@ -66,18 +67,26 @@ enum DefaultColorIds {
 	COLORID_WHITE = 19
 };
 
-extern const uint8_t default_color[20][3];
+extern const uint8_t default_color[20][3] PROGMEM; // in flash, read with pgm_read_byte()
 
 // Globals --------------------------------------------------------------------
 
 // Storage for the LED state
 extern uint8_t g_display_buffer[64 * 3];
-extern const uint8_t default_color[20][3];
+
+// Dirty tracking: per strand of 16 buttons, how many buttons from the start
+// of the strand have to be sent (0 = nothing changed).
+#define DISPLAY_STRANDS 4
+extern uint8_t g_display_dirty[DISPLAY_STRANDS];
+
+void display_mark_dirty(uint8_t button_id);
+void display_mark_all_dirty(void);
 extern const uint8_t ableton_midi_feedback_colors[128][3];
 
 // functions ------------------------------------------------------------------
 // - LED Refreshing
 void default_display_run(void); 
+void display_push(void);
 
 // - Animations
 void start_geometric_animation(void);
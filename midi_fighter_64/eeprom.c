@@ -27,11 +27,13 @@
 #include "key.h"
 #include "midi.h"
 #include "display.h"
+#include "fastrgb.h"
 #include "eeprom.h"
 #include "constants.h"
 
 uint8_t G_EE_MIDI_OUTPUT_MODE;
 uint8_t G_EE_SLEEP_TIME;
+uint8_t G_EE_PALETTE_MODE;
 
 // EEPROM functions ------------------------------------------------------------
 
@@ -96,6 +98,7 @@ void eeprom_setup(void)
     G_EE_MIDI_VELOCITY = eeprom_read(EE_MIDI_VELOCITY);
 	G_EE_MIDI_OUTPUT_MODE = eeprom_read(EE_MIDI_OUTPUT_MODE);
     G_EE_SLEEP_TIME = eeprom_read(EE_SLEEP_TIME);
+    G_EE_PALETTE_MODE = eeprom_read(EE_PALETTE_MODE);
 }
 
 // Return the EEPROM values to their factory default values, erasing any
@@ -133,16 +136,18 @@ void eeprom_factory_reset(void)
 	eeprom_write(EE_PICK_SENSITIVITY, 0x40);
 	eeprom_write(EE_SIDE_BANK, 0x00);
 	eeprom_write(EE_SLEEP_TIME, G_EE_SLEEP_TIME = 0x3C);
+	eeprom_write(EE_PALETTE_MODE, G_EE_PALETTE_MODE = FASTRGB_PALETTE_NOVATION);
+	fastrgb_user_palette_reset();
 	
     for (uint16_t i=0; i<NUM_BUTTONS*2; i++) {
         for (uint8_t j=0; j<3; j++) {
             eeprom_write(
                 EE_COLORS_IDLE+(i*3+j),
-                default_color[i < NUM_BUTTONS? COLORID_OFF : COLORID_WHITE][j]
+                pgm_read_byte(&default_color[i < NUM_BUTTONS? COLORID_OFF : COLORID_WHITE][j])
             );
             eeprom_write(
                 EE_COLORS_ACTIVE+(i*3+j),
-                default_color[i < NUM_BUTTONS? COLORID_BLUE : COLORID_GREEN][j]
+                pgm_read_byte(&default_color[i < NUM_BUTTONS? COLORID_BLUE : COLORID_GREEN][j])
             );
         }
     }
@@ -27,6 +27,7 @@
 
 extern uint8_t G_EE_MIDI_OUTPUT_MODE;
 extern uint8_t G_EE_SLEEP_TIME;
+extern uint8_t G_EE_PALETTE_MODE;
 
 
 // EEPROM functions -----------------------------------------------
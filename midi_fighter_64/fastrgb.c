@@ -1,25 +1,205 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "fastrgb.h"
+#include "key.h" // for system_time_ms
+#include "display.h" // for g_display_buffer and display_mark_dirty()
+#include "eeprom.h"
+#include "led.h" // for display_flash_counter
 
-uint8_t g_fastrgb_state[NUM_BUTTONS][3];
 
-const uint8_t novation_palette[128][3] = {
+const uint8_t novation_palette[128][3] PROGMEM = { // in flash, read with pgm_read_byte()
 	{0, 0, 0}, {16, 16, 16}, {32, 32, 32}, {63, 63, 63}, {63, 15, 15}, {63, 0, 0}, {32, 0, 0}, {16, 0, 0}, {63, 46, 26}, {63, 15, 0}, {32, 8, 0}, {16, 4, 0}, {63, 43, 11}, {63, 63, 0}, {32, 32, 0}, {16, 16, 0}, {33, 63, 12}, {20, 63, 0}, {10, 32, 0}, {5, 16, 0}, {18, 63, 18}, {0, 63, 0}, {0, 32, 0}, {0, 16, 0}, {18, 63, 23}, {0, 63, 6}, {0, 32, 3}, {0, 16, 1}, {18, 63, 22}, {0, 63, 21}, {0, 32, 11}, {0, 16, 6}, {18, 63, 45}, {0, 63, 37}, {0, 32, 18}, {0, 16, 9}, {18, 48, 63}, {0, 41, 63}, {0, 21, 32}, {0, 11, 16}, {18, 33, 63}, {0, 21, 63}, {0, 11, 32}, {0, 6, 16}, {11, 9, 63}, {0, 0, 63}, {0, 0, 32}, {0, 0, 16}, {26, 13, 62}, {11, 0, 63}, {6, 0, 32}, {3, 0, 16}, {63, 15, 63}, {63, 0, 63}, {32, 0, 32}, {16, 0, 16}, {63, 16, 27}, {63, 0, 20}, {32, 0, 10}, {16, 0, 5}, {63, 3, 0}, {37, 13, 0}, {29, 20, 0}, {8, 13, 1}, {0, 14, 0}, {0, 18, 6}, {0, 5, 27}, {0, 0, 63}, {0, 17, 19}, {4, 0, 50}, {31, 31, 31}, {7, 7, 7}, {63, 0, 0}, {46, 63, 11}, {43, 58, 1}, {24, 63, 2}, {3, 34, 0}, {0, 63, 23}, {0, 41, 63}, {0, 10, 63}, {6, 0, 63}, {22, 0, 63}, {43, 6, 30}, {10, 4, 0}, {63, 12, 0}, {33, 55, 1}, {28, 63, 5}, {0, 63, 0}, {14, 63, 9}, {21, 63, 27}, {13, 63, 50}, {22, 34, 63}, {12, 20, 48}, {26, 20, 57}, {52, 7, 63}, {63, 0, 22}, {63, 17, 0}, {45, 41, 0}, {35, 63, 0}, {32, 22, 1}, {14, 10, 0}, {0, 18, 3}, {3, 19, 8}, {5, 5, 10}, {5, 7, 22}, {25, 14, 6}, {32, 0, 0}, {54, 16, 10}, {53, 18, 4}, {63, 47, 9}, {39, 55, 11}, {25, 44, 3}, {5, 5, 11}, {54, 52, 26}, {31, 58, 34}, {38, 37, 63}, {35, 25, 63}, {15, 15, 15}, {28, 28, 28}, {55, 63, 63}, {39, 0, 0}, {13, 0, 0}, {6, 51, 0}, {1, 16, 0}, {45, 43, 0}, {15, 12, 0}, {44, 20, 0}, {18, 5, 0},
 };
 
+#if ENABLE_PAD_EFFECTS > 0
+// One bit per pad, indexed [p >> 3] & (1 << (p & 7)).
+static uint8_t fastrgb_flash_rows[NUM_BUTTONS / 8];
+static uint8_t fastrgb_pulse_rows[NUM_BUTTONS / 8];
+static uint16_t fastrgb_effect_color[NUM_BUTTONS]; // see fastrgb_palette_color()
+static uint8_t fastrgb_effect_phase;              // display_flash_counter & 0x07 when last drawn
+#endif
+
+#if ENABLE_PAD_FADES > 0
+typedef struct {
+	uint8_t to[3];     // 6-bit r, g, b
+	uint8_t beats;     // duration is in display_flash_counter steps, not ms
+	uint16_t start;
+	uint16_t duration;
+} fastrgb_fade_t;
+
+static fastrgb_fade_t fastrgb_fades[PAD_FADE_SLOTS];
+static uint8_t fastrgb_fade_slot[NUM_BUTTONS];        // slot + 1, 0 when not fading
+static uint8_t fastrgb_fade_from[NUM_BUTTONS][3];     // 6-bit r, g, b at the start
+static bool fastrgb_fades_active;
+#endif
+
 void fastrgb_clear(void) {
-	memset(g_fastrgb_state, 0, sizeof(g_fastrgb_state));
+	memset(g_display_buffer, 0, sizeof(g_display_buffer));
+#if ENABLE_PAD_EFFECTS > 0
+	memset(fastrgb_flash_rows, 0, sizeof(fastrgb_flash_rows));
+	memset(fastrgb_pulse_rows, 0, sizeof(fastrgb_pulse_rows));
+#endif
+#if ENABLE_PAD_FADES > 0
+	memset(fastrgb_fade_slot, 0, sizeof(fastrgb_fade_slot));
+#endif
+	display_mark_all_dirty();
 }
 
-inline void fastrgb_set_unsafe(uint8_t p, uint8_t r, uint8_t g, uint8_t b) {
-	g_fastrgb_state[p][0] = r == 0? 0 : (r + 2);
-	g_fastrgb_state[p][1] = g == 0? 0 : (g + 2);
-	g_fastrgb_state[p][2] = b == 0? 0 : (b + 2);
+// Stop any effect or fade on pad p, it is about to get a static color.
+static inline void fastrgb_cancel(uint8_t p) {
+#if ENABLE_PAD_EFFECTS > 0
+	fastrgb_flash_rows[p >> 3] &= ~(1 << (p & 7));
+	fastrgb_pulse_rows[p >> 3] &= ~(1 << (p & 7));
+#endif
+#if ENABLE_PAD_FADES > 0
+	fastrgb_fade_slot[p] = 0;
+#endif
 }
 
-inline void fastrgb_set(uint8_t p, uint8_t r, uint8_t g, uint8_t b) {
+static inline void fastrgb_set_unsafe(uint8_t p, uint8_t r, uint8_t g, uint8_t b) {
+	fastrgb_cancel(p);
+	// Stored in the order the LEDs are sent (B, R, G), see g_display_buffer.
+	g_display_buffer[p * 3 + 0] = b == 0? 0 : (b + 2);
+	g_display_buffer[p * 3 + 1] = r == 0? 0 : (r + 2);
+	g_display_buffer[p * 3 + 2] = g == 0? 0 : (g + 2);
+	display_mark_dirty(p);
+}
+
+static inline void fastrgb_set(uint8_t p, uint8_t r, uint8_t g, uint8_t b) {
 	fastrgb_set_unsafe(p & BUTTON_ID_FLAGS, r & 0x3F, g & 0x3F, b & 0x3F);
 }
 
+#if ENABLE_PAD_FADES > 0
+// Both clocks are written by interrupts; read them in one piece.
+static uint16_t fastrgb_fade_now(uint8_t beats) {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t now = beats? display_flash_counter : (uint16_t)system_time_ms;
+	SREG = sreg;
+	return now;
+}
+
+// Write a fading pad's color without cancelling its fade.
+static void fastrgb_fade_write(uint8_t p, const uint8_t* rgb) {
+	uint8_t* out = &g_display_buffer[p * 3];
+	uint8_t b = rgb[2] == 0? 0 : (rgb[2] + 2);
+	uint8_t r = rgb[0] == 0? 0 : (rgb[0] + 2);
+	uint8_t g = rgb[1] == 0? 0 : (rgb[1] + 2);
+	if (out[0] != b || out[1] != r || out[2] != g) {
+		out[0] = b;
+		out[1] = r;
+		out[2] = g;
+		display_mark_dirty(p);
+	}
+}
+
+// Pick a slot for a new fade. A free one if there is one, otherwise the
+// fade that is furthest along, as a fraction of its own duration so ms and
+// beat fades compare fairly, loses its slot and its pads jump to the target.
+static uint8_t fastrgb_fade_alloc(void) {
+	uint8_t used = 0;
+	for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+		if (fastrgb_fade_slot[p]) used |= 1 << (fastrgb_fade_slot[p] - 1);
+	}
+	for (uint8_t s = 0; s < PAD_FADE_SLOTS; s++) {
+		if (!(used & (1 << s))) return s;
+	}
+
+	// elapsed / duration of the best so far, compared by cross-multiplying.
+	uint8_t s = 0;
+	uint16_t best_elapsed = 0;
+	uint16_t best_duration = 1;
+	for (uint8_t i = 0; i < PAD_FADE_SLOTS; i++) {
+		fastrgb_fade_t* f = &fastrgb_fades[i];
+		uint16_t elapsed = fastrgb_fade_now(f->beats) - f->start;
+		uint16_t duration = f->duration;
+		if (elapsed >= duration) { // finished, just not drawn yet
+			elapsed = 1;
+			duration = 1;
+		}
+		if ((uint32_t)elapsed * best_duration > (uint32_t)best_elapsed * duration) {
+			s = i;
+			best_elapsed = elapsed;
+			best_duration = duration;
+		}
+	}
+
+	for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+		if (fastrgb_fade_slot[p] == s + 1) {
+			fastrgb_fade_write(p, fastrgb_fades[s].to);
+			fastrgb_fade_slot[p] = 0;
+		}
+	}
+	return s;
+}
+
+static void fastrgb_fade_begin(uint8_t s, uint8_t beats, uint16_t duration, uint8_t r, uint8_t g, uint8_t b) {
+	fastrgb_fade_t* f = &fastrgb_fades[s];
+	f->to[0] = r;
+	f->to[1] = g;
+	f->to[2] = b;
+	f->beats = beats;
+	f->duration = duration;
+	f->start = fastrgb_fade_now(beats);
+}
+
+// Start pad p on fade slot s from whatever it shows now.
+static void fastrgb_fade_pad(uint8_t p, uint8_t s) {
+	const uint8_t* in = &g_display_buffer[p * 3]; // B, R, G
+	fastrgb_fade_from[p][0] = in[1] == 0? 0 : (in[1] - 2);
+	fastrgb_fade_from[p][1] = in[2] == 0? 0 : (in[2] - 2);
+	fastrgb_fade_from[p][2] = in[0] == 0? 0 : (in[0] - 2);
+#if ENABLE_PAD_EFFECTS > 0
+	fastrgb_flash_rows[p >> 3] &= ~(1 << (p & 7));
+	fastrgb_pulse_rows[p >> 3] &= ~(1 << (p & 7));
+#endif
+	fastrgb_fade_slot[p] = s + 1;
+	fastrgb_fades_active = true;
+}
+
+void fastrgb_fades_tick(void) {
+	if (!fastrgb_fades_active) return;
+
+	// Progress of each running fade, 0..256.
+	uint16_t progress[PAD_FADE_SLOTS];
+	uint8_t used = 0;
+	for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+		if (fastrgb_fade_slot[p]) used |= 1 << (fastrgb_fade_slot[p] - 1);
+	}
+	if (!used) {
+		fastrgb_fades_active = false;
+		return;
+	}
+	for (uint8_t s = 0; s < PAD_FADE_SLOTS; s++) {
+		if (!(used & (1 << s))) continue;
+		fastrgb_fade_t* f = &fastrgb_fades[s];
+		uint16_t elapsed = fastrgb_fade_now(f->beats) - f->start;
+		progress[s] = elapsed >= f->duration? 256 : (uint16_t)(((uint32_t)elapsed << 8) / f->duration);
+	}
+
+	for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+		uint8_t s = fastrgb_fade_slot[p];
+		if (!s) continue;
+		s--;
+
+		uint16_t t = progress[s];
+		uint8_t rgb[3];
+		for (uint8_t i = 0; i < 3; i++) {
+			rgb[i] = (fastrgb_fade_from[p][i] * (256 - t) + fastrgb_fades[s].to[i] * t) >> 8;
+		}
+		fastrgb_fade_write(p, rgb);
+		if (t == 256) fastrgb_fade_slot[p] = 0;
+	}
+}
+
+void fastrgb_fades_rebase(uint16_t restart) {
+	for (uint8_t s = 0; s < PAD_FADE_SLOTS; s++) {
+		if (fastrgb_fades[s].beats) fastrgb_fades[s].start -= restart;
+	}
+}
+#endif
+
 /*
 Decompression algorithm designed to reduce stress on Windows' MIDI stack for Apollo Studio
 Originally from https://github.com/mat1jaczyyy/lpp-performance-cfw/blob/b764a83a896cd121227f8c6986d32947276d2891/src/sysex/sysex.c#L61-L119
@@ -31,59 +211,461 @@ Adapted for MIDI Fighter 64
 104-111 controls an entire column.
 112-127 controls the 6-bit pitch value, and mirrors it to all four quadrants.
 */
-void fastrgb_decompress(uint8_t* d, uint8_t* end) {
-	for (uint8_t* i = d; i < end;) {
-		uint8_t r = *i++;
-		uint8_t g = *i++;
-		uint8_t b = *i++;
+static void fastrgb_decompress_target(uint8_t x, uint8_t r, uint8_t g, uint8_t b) {
+	if ((x & 0b01110000) != 0b01100000) {
+		fastrgb_set_unsafe(x & BUTTON_ID_FLAGS, r, g, b);
 
-		uint8_t n = ((r & 0x40) >> 4) | ((g & 0x40) >> 5) | ((b & 0x40) >> 6);
-		if (n == 0) n = *i++;
+		if (x & 0b01000000) {
+			uint8_t x_ = ~x & BUTTON_ID_FLAGS;
+			fastrgb_set_unsafe(x_, r, g, b);
 
-		r &= 0x3F;
-		g &= 0x3F;
-		b &= 0x3F;
+			if (x & 0b00100000) {
+				fastrgb_set_unsafe((x & 0b00011100) | (x_ & 0b00000011), r, g, b);
+				fastrgb_set_unsafe((x & 0b00100011) | (x_ & 0b00011100), r, g, b);
+			}
+		}
 
-		for (uint8_t j = 0; j < n; j++) {
-			uint8_t x = *i++;
+	} else if (x & 0b00001000) {
+		uint8_t col = x & (x & 0b00000100? 0b00100011 : 0b00000011);
 
-			if ((x & 0b01110000) != 0b01100000) {
-				fastrgb_set_unsafe(x & BUTTON_ID_FLAGS, r, g, b);
+		for (uint8_t k = 0; k < 8; k++) {
+			fastrgb_set_unsafe(col | (k << 2), r, g, b);
+		}
 
-				if (x & 0b01000000) {
-					uint8_t x_ = ~x & BUTTON_ID_FLAGS;
-					fastrgb_set_unsafe(x_, r, g, b);
+	} else {
+		uint8_t row = ((x & 0b00000111) << 2);
 
-					if (x & 0b00100000) {
-						fastrgb_set_unsafe((x & 0b00011100) | (x_ & 0b00000011), r, g, b);
-						fastrgb_set_unsafe((x & 0b00100011) | (x_ & 0b00011100), r, g, b);
-					}
-				}
+		for (uint8_t k = 0; k < 4; k++) {
+			fastrgb_set_unsafe(row | k, r, g, b);
+			fastrgb_set_unsafe(row | 0b00100000 | k, r, g, b);
+		}
+	}
+}
 
-			} else if (x & 0b00001000) {
-				uint8_t col = x & (x & 0b00000100? 0b00100011 : 0b00000011);
+// Streaming decoder state. The SysEx handler feeds data bytes in as each
+// USB-MIDI packet arrives, so pads update without buffering the message.
+typedef struct {
+	uint8_t format;
+	uint8_t pos;   // byte index within the current group
+	uint8_t count; // targets left, next pad, RLE state or fade slot
+	uint8_t data[FASTRGB_BITMAP_BYTES + 3]; // see the per-format decoders
+} fastrgb_stream_t;
 
-				for (uint8_t k = 0; k < 8; k++) {
-					fastrgb_set_unsafe(col | (k << 2), r, g, b);
-				}
+static fastrgb_stream_t fastrgb_stream; // the SysEx being received
 
-			} else {
-				uint8_t row = ((x & 0b00000111) << 2);
+static void fastrgb_stream_init(fastrgb_stream_t* st, uint8_t format) {
+	st->format = format;
+	st->pos = 0;
+	st->count = 0;
+}
+
+static void fastrgb_stream_compressed(fastrgb_stream_t* st, uint8_t v) {
+	uint8_t* c = st->data;
+
+	if (st->pos < 3) {
+		c[st->pos++] = v;
+		if (st->pos == 3) {
+			st->count = ((c[0] & 0x40) >> 4) | ((c[1] & 0x40) >> 5) | ((c[2] & 0x40) >> 6);
+			c[0] &= 0x3F;
+			c[1] &= 0x3F;
+			c[2] &= 0x3F;
+			// A count of zero in the flag bits means an explicit count byte follows.
+			st->pos = st->count == 0? 3 : 4;
+		}
+
+	} else if (st->pos == 3) {
+		st->count = v;
+		st->pos = v == 0? 0 : 4;
+
+	} else {
+		fastrgb_decompress_target(v, c[0], c[1], c[2]);
+		if (--st->count == 0) st->pos = 0;
+	}
+}
+
+static void fastrgb_stream_list(fastrgb_stream_t* st, uint8_t v) {
+	st->data[st->pos++] = v;
+	if (st->pos == 4) {
+		uint8_t* c = st->data;
+		fastrgb_set(c[0], c[1], c[2], c[3]);
+		st->pos = 0;
+	}
+}
+
+/*
+Delta-bitmap format (0x4F), for many scattered pads with different colors.
+
+The first FASTRGB_BITMAP_BYTES bytes are a 64-bit changed-pad bitmap packed
+7 bits per byte, LSB first: bit j of byte k is pad 7*k + j. Then one 6-bit
+r, g, b triple follows for each set bit, in ascending pad order. Unchanged
+pads cost one bit instead of four bytes.
+*/
+static uint8_t fastrgb_bitmap_next(const fastrgb_stream_t* st, uint8_t p) {
+	while (p < NUM_BUTTONS && !(st->data[p / 7] & (1 << (p % 7)))) p++;
+	return p;
+}
+
+static void fastrgb_stream_bitmap(fastrgb_stream_t* st, uint8_t v) {
+	uint8_t* c = st->data; // bitmap, then r, g, b
+	uint8_t p = st->count; // next changed pad
+
+	if (st->pos < FASTRGB_BITMAP_BYTES) {
+		c[st->pos++] = v;
+		if (st->pos == FASTRGB_BITMAP_BYTES) {
+			st->count = fastrgb_bitmap_next(st, 0);
+		}
+
+	} else if (p < NUM_BUTTONS) {
+		c[st->pos++] = v;
+		if (st->pos == FASTRGB_BITMAP_BYTES + 3) {
+			fastrgb_set_unsafe(p, c[FASTRGB_BITMAP_BYTES] & 0x3F,
+				c[FASTRGB_BITMAP_BYTES + 1] & 0x3F, c[FASTRGB_BITMAP_BYTES + 2] & 0x3F);
+			st->count = fastrgb_bitmap_next(st, p + 1);
+			st->pos = FASTRGB_BITMAP_BYTES;
+		}
+	}
+}
+
+/*
+Indexed full-frame format (0x3F): novation_palette indices for pads 0, 1, 2...
+in order, with run-length encoding.
+
+An index that repeats the one just before it is followed by a count byte
+giving how many more pads (0-127) take that color. A solid frame is 3 bytes,
+and no frame is longer than 96 bytes (pairs of equal indices).
+*/
+#define FASTRGB_RLE_START  0 // no previous index
+#define FASTRGB_RLE_SINGLE 1 // previous index seen once
+#define FASTRGB_RLE_COUNT  2 // previous index seen twice, count byte next
+
+static void fastrgb_stream_indexed(fastrgb_stream_t* st, uint8_t v) {
+	uint8_t* last = &st->data[0];
+	uint8_t p = st->pos; // next pad
+
+	if (st->count == FASTRGB_RLE_COUNT) {
+		while (v-- && p < NUM_BUTTONS) fastrgb_ableton_single(p++, *last);
+		st->count = FASTRGB_RLE_START;
+
+	} else if (p < NUM_BUTTONS) {
+		fastrgb_ableton_single(p++, v);
+		st->count = (st->count == FASTRGB_RLE_SINGLE && v == *last)?
+			FASTRGB_RLE_COUNT : FASTRGB_RLE_SINGLE;
+		*last = v;
+	}
+
+	st->pos = p;
+}
+
+#if ENABLE_PAD_FADES > 0
+/*
+Fade format (0x2F): unit, duration MSB, duration LSB, r, g, b, then pad ids.
+
+unit 0 counts the 14-bit duration in ms, unit 1 in display_flash_counter
+steps (8 per beat). Every listed pad fades from its current color to the
+6-bit r, g, b over that time.
+*/
+static void fastrgb_stream_fade(fastrgb_stream_t* st, uint8_t v) {
+	uint8_t* c = st->data;
+
+	if (st->pos < 6) {
+		c[st->pos++] = v;
+		if (st->pos == 6) {
+			st->count = fastrgb_fade_alloc();
+			fastrgb_fade_begin(st->count, c[0] != 0, (uint16_t)c[1] << 7 | c[2],
+				c[3] & 0x3F, c[4] & 0x3F, c[5] & 0x3F);
+		}
+	} else if (v < NUM_BUTTONS) {
+		fastrgb_fade_pad(v, st->count);
+	}
+}
+#endif
+
+#if ENABLE_GRID_TRANSFORMS > 0
+/*
+Transform format (0x0F): a list of operations, each an opcode followed by its
+arguments, applied to the grid in order. Opcodes below FASTRGB_DRAW_RECT
+move colors around, the others draw new ones into a rectangle given by two
+corners (row, column), both included.
+
+Positions use the drum rack geometry of get_button_id_from_row_column(): row
+0 is the bottom row, column 0 the left column. dx and dy are signed 7-bit
+(0x7F is -1), positive moving the pads right and up. Quadrants are 0 bottom
+left, 1 bottom right, 2 top left and 3 top right.
+
+Pads that take another pad's color, or are drawn, lose their effect or fade.
+A gradient runs from the first corner (r0, g0, b0) to the second (r1, g1,
+b1) along the rows, the columns, or both for a diagonal.
+*/
+static const uint8_t fastrgb_transform_args[] PROGMEM = {
+	5, // FASTRGB_TRANSFORM_SHIFT
+	2, // FASTRGB_TRANSFORM_SCROLL
+	1, // FASTRGB_TRANSFORM_ROTATE
+	1, // FASTRGB_TRANSFORM_MIRROR
+	2, // FASTRGB_TRANSFORM_COPY
+	7, // FASTRGB_DRAW_RECT
+	11, // FASTRGB_DRAW_GRADIENT
+};
+
+static inline int8_t fastrgb_signed7(uint8_t v) {
+	return (v & 0x40)? (int8_t)(v | 0x80) : (int8_t)v;
+}
+
+// The pad whose color ends up at row, column, 0xFF for none.
+static uint8_t fastrgb_transform_source(const uint8_t* c, uint8_t row, uint8_t col) {
+	const uint8_t last = GEOMETRIC_ANIMATION_ROWS - 1;
+
+	switch (c[0]) {
+	case FASTRGB_TRANSFORM_SHIFT:
+	case FASTRGB_TRANSFORM_SCROLL:
+		row -= fastrgb_signed7(c[2]);
+		col -= fastrgb_signed7(c[1]);
+		if (c[0] == FASTRGB_TRANSFORM_SCROLL) {
+			row &= last;
+			col &= last;
+		}
+		break;
+	case FASTRGB_TRANSFORM_ROTATE:
+		for (uint8_t k = c[1] & 0x03; k > 0; k--) {
+			uint8_t t = row;
+			row = col;
+			col = last - t;
+		}
+		break;
+	case FASTRGB_TRANSFORM_MIRROR:
+		if (c[1]) row = last - row;
+		else col = last - col;
+		break;
+	case FASTRGB_TRANSFORM_COPY:
+		if ((row & 0x04) == ((c[2] & 0x02) << 1) && (col & 0x04) == ((c[2] & 0x01) << 2)) {
+			row = (row & 0x03) | ((c[1] & 0x02) << 1);
+			col = (col & 0x03) | ((c[1] & 0x01) << 2);
+		}
+		break;
+	}
+	return get_button_id_from_row_column(row, col);
+}
+
+// Give pad p the color at from, stopping its effect or fade if the color
+// came from another pad.
+static void fastrgb_transform_move(uint8_t p, const uint8_t* from, bool moved) {
+	if (moved) fastrgb_cancel(p);
+	if (memcmp(&g_display_buffer[p * 3], from, 3) != 0) {
+		memcpy(&g_display_buffer[p * 3], from, 3);
+		display_mark_dirty(p);
+	}
+}
 
-				for (uint8_t k = 0; k < 4; k++) {
-					fastrgb_set_unsafe(row | k, r, g, b);
-					fastrgb_set_unsafe(row | 0b00100000 | k, r, g, b);
+static inline uint8_t fastrgb_transform_pad_source(const uint8_t* c, uint8_t p) {
+	return fastrgb_transform_source(c, (p & 0x1F) >> 2, (p & 0x03) | ((p & 0x20) >> 3));
+}
+
+// Done in place, with no copy of the grid: scroll, rotate and mirror move
+// every pad, so each cycle of pads is followed round once. Shift goes
+// through the pads from the side it moves towards, so every pad is read
+// before it is overwritten, and a quadrant copy never writes the pads it
+// reads from.
+static void fastrgb_transform(const uint8_t* c) {
+	if (c[0] == FASTRGB_TRANSFORM_SHIFT || c[0] == FASTRGB_TRANSFORM_COPY) {
+		const uint8_t last = GEOMETRIC_ANIMATION_ROWS - 1;
+		bool up = c[0] == FASTRGB_TRANSFORM_SHIFT && fastrgb_signed7(c[2]) > 0;
+		bool right = c[0] == FASTRGB_TRANSFORM_SHIFT && fastrgb_signed7(c[1]) > 0;
+		// Same order as g_display_buffer, only used by FASTRGB_TRANSFORM_SHIFT.
+		uint8_t fill[3] = {
+			(c[5] & 0x3F) == 0? 0 : (c[5] & 0x3F) + 2,
+			(c[3] & 0x3F) == 0? 0 : (c[3] & 0x3F) + 2,
+			(c[4] & 0x3F) == 0? 0 : (c[4] & 0x3F) + 2,
+		};
+
+		for (uint8_t i = 0; i <= last; i++) {
+			uint8_t row = up? last - i : i;
+			for (uint8_t j = 0; j <= last; j++) {
+				uint8_t col = right? last - j : j;
+				uint8_t p = get_button_id_from_row_column(row, col);
+				uint8_t src = fastrgb_transform_source(c, row, col);
+				if (src != p) {
+					fastrgb_transform_move(p, src < NUM_BUTTONS? &g_display_buffer[src * 3] : fill, true);
 				}
 			}
 		}
+		return;
+	}
+
+	uint8_t visited[NUM_BUTTONS / 8] = {0};
+	for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+		if (visited[p >> 3] & (1 << (p & 7))) continue;
+		uint8_t first[3];
+		memcpy(first, &g_display_buffer[p * 3], 3);
+
+		uint8_t d = p;
+		for (;;) {
+			visited[d >> 3] |= 1 << (d & 7);
+			uint8_t src = fastrgb_transform_pad_source(c, d);
+			if (src == p) {
+				fastrgb_transform_move(d, first, d != p);
+				break;
+			}
+			fastrgb_transform_move(d, &g_display_buffer[src * 3], true);
+			d = src;
+		}
+	}
+}
+
+static inline uint8_t fastrgb_distance(uint8_t a, uint8_t b) {
+	return a > b? a - b : b - a;
+}
+
+// t steps of span from a to b, rounded.
+static uint8_t fastrgb_mix(uint8_t a, uint8_t b, uint8_t t, uint8_t span) {
+	a &= 0x3F;
+	b &= 0x3F;
+	if (span == 0) return a;
+	return ((uint16_t)a * (span - t) + (uint16_t)b * t + span / 2) / span;
+}
+
+static void fastrgb_draw(const uint8_t* c) {
+	const uint8_t last = GEOMETRIC_ANIMATION_ROWS - 1;
+	uint8_t row0 = c[1] < last? c[1] : last;
+	uint8_t col0 = c[2] < last? c[2] : last;
+	uint8_t row1 = c[3] < last? c[3] : last;
+	uint8_t col1 = c[4] < last? c[4] : last;
+	uint8_t gradient = c[5];
+	uint8_t span = 0;
+
+	if (c[0] == FASTRGB_DRAW_GRADIENT) {
+		if (gradient != FASTRGB_GRADIENT_VERTICAL) span += fastrgb_distance(col0, col1);
+		if (gradient != FASTRGB_GRADIENT_HORIZONTAL) span += fastrgb_distance(row0, row1);
+	}
+
+	for (uint8_t row = 0; row <= last; row++) {
+		if (row < row0 && row < row1) continue;
+		if (row > row0 && row > row1) continue;
+		for (uint8_t col = 0; col <= last; col++) {
+			if (col < col0 && col < col1) continue;
+			if (col > col0 && col > col1) continue;
+			uint8_t p = get_button_id_from_row_column(row, col);
+
+			if (c[0] == FASTRGB_DRAW_RECT) {
+				fastrgb_set_unsafe(p, c[5] & 0x3F, c[6] & 0x3F, c[7] & 0x3F);
+			} else {
+				uint8_t t = 0;
+				if (gradient != FASTRGB_GRADIENT_VERTICAL) t += fastrgb_distance(col, col0);
+				if (gradient != FASTRGB_GRADIENT_HORIZONTAL) t += fastrgb_distance(row, row0);
+				fastrgb_set_unsafe(p, fastrgb_mix(c[6], c[9], t, span),
+					fastrgb_mix(c[7], c[10], t, span), fastrgb_mix(c[8], c[11], t, span));
+			}
+		}
 	}
 }
 
-void fastrgb_list(uint8_t* d, uint8_t* end) {
-	for (uint8_t* i = d; i + 3 < end; i += 4) {
-		fastrgb_set(i[0], i[1], i[2], i[3]);
+static void fastrgb_stream_transform(fastrgb_stream_t* st, uint8_t v) {
+	uint8_t* c = st->data;
+
+	if (st->pos == 0) {
+		if (v >= sizeof(fastrgb_transform_args)) {
+			st->format = FASTRGB_STREAM_NONE; // unknown opcode, ignore the rest
+			return;
+		}
+		st->count = pgm_read_byte(&fastrgb_transform_args[v]);
+	}
+	c[st->pos++] = v;
+	if (st->pos > st->count) {
+		if (c[0] >= FASTRGB_DRAW_RECT) fastrgb_draw(c);
+		else fastrgb_transform(c);
+		st->pos = 0;
 	}
 }
+#endif
+
+static void fastrgb_stream_feed(fastrgb_stream_t* st, uint8_t v) {
+	if (v & 0x80) {
+		// Status byte (normally the 0xF7 terminator) ends the stream.
+		st->format = FASTRGB_STREAM_NONE;
+	} else if (st->format == FASTRGB_STREAM_COMPRESSED) {
+		fastrgb_stream_compressed(st, v);
+	} else if (st->format == FASTRGB_STREAM_LIST) {
+		fastrgb_stream_list(st, v);
+	} else if (st->format == FASTRGB_STREAM_BITMAP) {
+		fastrgb_stream_bitmap(st, v);
+	} else if (st->format == FASTRGB_STREAM_INDEXED) {
+		fastrgb_stream_indexed(st, v);
+#if ENABLE_PAD_FADES > 0
+	} else if (st->format == FASTRGB_STREAM_FADE) {
+		fastrgb_stream_fade(st, v);
+#endif
+#if ENABLE_GRID_TRANSFORMS > 0
+	} else if (st->format == FASTRGB_STREAM_TRANSFORM) {
+		fastrgb_stream_transform(st, v);
+#endif
+	}
+}
+
+void fastrgb_stream_begin(uint8_t format) {
+	fastrgb_stream_init(&fastrgb_stream, format);
+}
+
+void fastrgb_stream_byte(uint8_t v) {
+	fastrgb_stream_feed(&fastrgb_stream, v);
+}
+
+// Buffered decodes get their own state, so they can run (e.g. from stored
+// sequences) while a lighting SysEx is still arriving.
+void fastrgb_decompress(const uint8_t* d, const uint8_t* end) {
+	fastrgb_stream_t st;
+	fastrgb_stream_init(&st, FASTRGB_STREAM_COMPRESSED);
+	while (d < end) fastrgb_stream_feed(&st, *d++);
+}
+
+// The reverse of fastrgb_decompress() for the whole grid: one group per
+// distinct color, with the pad count in the flag bits when it is 1-7.
+uint16_t fastrgb_compress(uint8_t* out, uint16_t max) {
+	uint8_t done[NUM_BUTTONS / 8] = {0};
+	uint16_t len = 0;
+
+	for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+		if (done[p >> 3] & (1 << (p & 7))) continue;
+		const uint8_t* c = &g_display_buffer[p * 3];
+
+		uint8_t n = 0;
+		for (uint8_t q = p; q < NUM_BUTTONS; q++) {
+			if (!memcmp(&g_display_buffer[q * 3], c, 3)) n++;
+		}
+		uint8_t header = n < 8? 3 : 4;
+		if (len + header + n > max) return 0;
+
+		if (out) {
+			// B, R, G in the buffer, r, g, b on the wire
+			uint8_t r = c[1] == 0? 0 : ((c[1] - 2) & 0x3F);
+			uint8_t g = c[2] == 0? 0 : ((c[2] - 2) & 0x3F);
+			uint8_t b = c[0] == 0? 0 : ((c[0] - 2) & 0x3F);
+			if (n < 8) {
+				out[len + 0] = r | (n & 4) << 4;
+				out[len + 1] = g | (n & 2) << 5;
+				out[len + 2] = b | (n & 1) << 6;
+			} else {
+				out[len + 0] = r;
+				out[len + 1] = g;
+				out[len + 2] = b;
+				out[len + 3] = n;
+			}
+		}
+		len += header;
+
+		for (uint8_t q = p; q < NUM_BUTTONS; q++) {
+			if (!memcmp(&g_display_buffer[q * 3], c, 3)) {
+				if (out) out[len] = q;
+				len++;
+				done[q >> 3] |= 1 << (q & 7);
+			}
+		}
+	}
+	return len;
+}
+
+void fastrgb_list(const uint8_t* d, const uint8_t* end) {
+	fastrgb_stream_t st;
+	fastrgb_stream_init(&st, FASTRGB_STREAM_LIST);
+	while (d < end) fastrgb_stream_feed(&st, *d++);
+}
 
 void fastrgb_single(uint8_t p, uint8_t r, uint8_t g, uint8_t b) {
 	fastrgb_set(p, r, g, b);
@@ -93,11 +675,168 @@ void fastrgb_single_unsafe(uint8_t p, uint8_t r, uint8_t g, uint8_t b) {
 	fastrgb_set_unsafe(p, r, g, b);
 }
 
+// The user palette lives in EEPROM at 4 bits per channel (see
+// EE_USER_PALETTE_RG) and read back through a small cache to save RAM.
+static inline uint8_t fastrgb_nibble_to_6bit(uint8_t n) {
+	return (n << 2) | (n >> 2);
+}
+
+// Red/green of entry v; the last 16 entries sit below EE_FACTORY_RESET_FLAG.
+static inline uint16_t fastrgb_user_palette_rg_address(uint8_t v) {
+	return v < 112? EE_USER_PALETTE_RG + v : EE_USER_PALETTE_RG_TAIL + (v - 112);
+}
+
+// Direct-mapped cache of user palette lookups, slot v & 7, so a run of
+// NoteOns over a few velocities doesn't read the EEPROM twice each time.
+// A tag is the cached velocity, or 0xFF when the slot is empty.
+#define FASTRGB_PALETTE_CACHE_SIZE 8
+static uint8_t fastrgb_palette_cache_tag[FASTRGB_PALETTE_CACHE_SIZE] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static uint16_t fastrgb_palette_cache_color[FASTRGB_PALETTE_CACHE_SIZE];
+
+// Each EEPROM write takes about 3.4ms and wears the cell, so leave bytes
+// that already hold the value alone.
+static void fastrgb_eeprom_update(uint16_t address, uint8_t data) {
+	if (eeprom_read(address) != data) eeprom_write(address, data);
+}
+
+void fastrgb_user_palette_write(uint8_t v, uint8_t r, uint8_t g, uint8_t b) {
+	v &= 0x7F;
+	fastrgb_palette_cache_tag[v & (FASTRGB_PALETTE_CACHE_SIZE - 1)] = 0xFF;
+	fastrgb_eeprom_update(fastrgb_user_palette_rg_address(v), (r & 0x3C) << 2 | (g & 0x3C) >> 2);
+
+	uint8_t bb = eeprom_read(EE_USER_PALETTE_B + (v >> 1));
+	if (v & 1) bb = (bb & 0x0F) | (b & 0x3C) << 2;
+	else       bb = (bb & 0xF0) | (b & 0x3C) >> 2;
+	fastrgb_eeprom_update(EE_USER_PALETTE_B + (v >> 1), bb);
+}
+
+// Start the user palette as a copy of the Novation one. This is part of a
+// factory reset and blocks for up to 192 EEPROM writes (128 red/green bytes
+// and 64 blue bytes, each blue byte written once per entry pair), about
+// 0.65s on a blank or fully customized palette. Bytes that already hold the
+// Novation value are skipped, so a reset of an untouched palette is quick.
+void fastrgb_user_palette_reset(void) {
+	memset(fastrgb_palette_cache_tag, 0xFF, sizeof(fastrgb_palette_cache_tag));
+	for (uint8_t v = 0; v < 128; v++) {
+		uint8_t r = pgm_read_byte(&novation_palette[v][0]);
+		uint8_t g = pgm_read_byte(&novation_palette[v][1]);
+		fastrgb_eeprom_update(fastrgb_user_palette_rg_address(v), (r & 0x3C) << 2 | (g & 0x3C) >> 2);
+	}
+	for (uint8_t v = 0; v < 128; v += 2) {
+		uint8_t b0 = pgm_read_byte(&novation_palette[v][2]);
+		uint8_t b1 = pgm_read_byte(&novation_palette[v + 1][2]);
+		fastrgb_eeprom_update(EE_USER_PALETTE_B + (v >> 1), (b1 & 0x3C) << 2 | (b0 & 0x3C) >> 2);
+	}
+}
+
+#define FASTRGB_COLOR_NOVATION 0x8000 // low 7 bits are a novation_palette index
+
+// Velocity v in the selected palette, in 16 bits: a user color as 4-bit
+// r, g, b (0x0RGB) read from EEPROM once here, or a Novation color as its
+// index | FASTRGB_COLOR_NOVATION, since flash is cheap to read again.
+static uint16_t fastrgb_palette_color(uint8_t v) {
+	v &= 0x7F;
+
+	if (G_EE_PALETTE_MODE == FASTRGB_PALETTE_USER) {
+		uint8_t slot = v & (FASTRGB_PALETTE_CACHE_SIZE - 1);
+		if (fastrgb_palette_cache_tag[slot] != v) {
+			uint8_t rg = eeprom_read(fastrgb_user_palette_rg_address(v));
+			uint8_t bb = eeprom_read(EE_USER_PALETTE_B + (v >> 1));
+			fastrgb_palette_cache_color[slot] = (uint16_t)rg << 4 | (v & 1? bb >> 4 : bb & 0x0F);
+			fastrgb_palette_cache_tag[slot] = v;
+		}
+		return fastrgb_palette_cache_color[slot];
+	}
+	return FASTRGB_COLOR_NOVATION | v;
+}
+
+// A fastrgb_palette_color() as 6-bit r, g, b.
+static void fastrgb_color_rgb(uint16_t c, uint8_t* rgb) {
+	if (c & FASTRGB_COLOR_NOVATION) {
+		const uint8_t* color = novation_palette[c & 0x7F];
+		rgb[0] = pgm_read_byte(&color[0]);
+		rgb[1] = pgm_read_byte(&color[1]);
+		rgb[2] = pgm_read_byte(&color[2]);
+		return;
+	}
+	rgb[0] = fastrgb_nibble_to_6bit((c >> 8) & 0x0F);
+	rgb[1] = fastrgb_nibble_to_6bit((c >> 4) & 0x0F);
+	rgb[2] = fastrgb_nibble_to_6bit(c & 0x0F);
+}
+
 void fastrgb_ableton_single(uint8_t p, uint8_t v) {
-	fastrgb_set_unsafe(
-		p,
-		novation_palette[v & 0x7F][0],
-		novation_palette[v & 0x7F][1],
-		novation_palette[v & 0x7F][2]
-	);
+	uint8_t rgb[3];
+	fastrgb_color_rgb(fastrgb_palette_color(v), rgb);
+	fastrgb_set_unsafe(p, rgb[0], rgb[1], rgb[2]);
+}
+
+#if ENABLE_PAD_EFFECTS > 0
+// Pulse brightness (out of 64) for each of the 8 display_flash_counter steps
+// in a beat.
+static const uint8_t fastrgb_pulse_levels[8] PROGMEM = {16, 24, 36, 50, 64, 50, 36, 24};
+
+// Scale a 6-bit channel by scale/64 and store it like fastrgb_set_unsafe().
+static inline uint8_t fastrgb_scale(uint8_t c, uint8_t scale) {
+	c = (uint16_t)c * scale >> 6;
+	return c == 0? 0 : (c + 2);
+}
+
+void fastrgb_effect_set(uint8_t p, uint8_t effect, uint8_t v) {
+	uint8_t row = p >> 3;
+	uint8_t bit = 1 << (p & 7);
+
+	fastrgb_flash_rows[row] &= ~bit;
+	fastrgb_pulse_rows[row] &= ~bit;
+	if (v) {
+		// Resolved now, so drawing it every frame never waits on the EEPROM.
+		fastrgb_effect_color[p] = fastrgb_palette_color(v);
+		if (effect == FASTRGB_EFFECT_FLASH) fastrgb_flash_rows[row] |= bit;
+		else                                fastrgb_pulse_rows[row] |= bit;
+	}
+	display_mark_dirty(p);
+}
+
+bool fastrgb_effects_tick(void) {
+	bool any = false;
+	for (uint8_t row = 0; row < NUM_BUTTONS / 8; row++) {
+		if (fastrgb_flash_rows[row] | fastrgb_pulse_rows[row]) any = true;
+	}
+	if (!any) return false;
+
+	uint8_t phase = (uint8_t)display_flash_counter & 0x07; // low byte only, no need for cli()
+	if (phase != fastrgb_effect_phase) {
+		fastrgb_effect_phase = phase;
+		for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+			if ((fastrgb_flash_rows[p >> 3] | fastrgb_pulse_rows[p >> 3]) & (1 << (p & 7))) {
+				display_mark_dirty(p);
+			}
+		}
+	}
+	return true;
+}
+
+void fastrgb_effects_render(uint8_t* frame) {
+	uint8_t flash_on = fastrgb_effect_phase & 0x04;
+	uint8_t level = pgm_read_byte(&fastrgb_pulse_levels[fastrgb_effect_phase]);
+
+	for (uint8_t p = 0; p < NUM_BUTTONS; p++) {
+		uint8_t bit = 1 << (p & 7);
+		uint8_t scale;
+		if (fastrgb_flash_rows[p >> 3] & bit) {
+			if (!flash_on) continue; // off phase shows the static color
+			scale = 64;
+		} else if (fastrgb_pulse_rows[p >> 3] & bit) {
+			scale = level;
+		} else {
+			continue;
+		}
+
+		uint8_t rgb[3];
+		fastrgb_color_rgb(fastrgb_effect_color[p], rgb);
+		// Same B, R, G order as fastrgb_set_unsafe()
+		frame[p * 3 + 0] = fastrgb_scale(rgb[2], scale);
+		frame[p * 3 + 1] = fastrgb_scale(rgb[0], scale);
+		frame[p * 3 + 2] = fastrgb_scale(rgb[1], scale);
+	}
 }
+#endif
@@ -6,13 +6,45 @@
 
 #include "constants.h"
 
-extern uint8_t g_fastrgb_state[NUM_BUTTONS][3];
-
 extern void fastrgb_clear(void);
 
-extern void fastrgb_decompress(uint8_t* d, uint8_t* end);
+// Streaming decode of the 0x5F (compressed), 0x6F (list), 0x4F (delta
+// bitmap), 0x3F (indexed RLE), 0x2F (fade) and 0x0F (transform) lighting SysEx.
+#define FASTRGB_STREAM_NONE        0
+#define FASTRGB_STREAM_COMPRESSED  1
+#define FASTRGB_STREAM_LIST        2
+#define FASTRGB_STREAM_BITMAP      3
+#define FASTRGB_STREAM_INDEXED     4
+#define FASTRGB_STREAM_FADE        5
+#define FASTRGB_STREAM_TRANSFORM   6
+
+#define FASTRGB_BITMAP_BYTES      10  // 64 pad bits packed 7 per byte
+
+// Transform and draw opcodes (0x0F) and their arguments.
+#define FASTRGB_TRANSFORM_SHIFT    0  // dx, dy, r, g, b: vacated pads take r, g, b
+#define FASTRGB_TRANSFORM_SCROLL   1  // dx, dy: pads moved off one edge come back on the other
+#define FASTRGB_TRANSFORM_ROTATE   2  // quarter turns clockwise
+#define FASTRGB_TRANSFORM_MIRROR   3  // 0 swaps left and right, 1 top and bottom
+#define FASTRGB_TRANSFORM_COPY     4  // source quadrant, destination quadrant
+#define FASTRGB_DRAW_RECT          5  // row, column, row, column, r, g, b
+#define FASTRGB_DRAW_GRADIENT      6  // row, column, row, column, direction, r0, g0, b0, r1, g1, b1
+
+// Gradient directions
+#define FASTRGB_GRADIENT_HORIZONTAL 0
+#define FASTRGB_GRADIENT_VERTICAL   1
+#define FASTRGB_GRADIENT_DIAGONAL   2
+
+extern void fastrgb_stream_begin(uint8_t format);
 
-extern void fastrgb_list(uint8_t* d, uint8_t* end);
+extern void fastrgb_stream_byte(uint8_t v);
+
+extern void fastrgb_decompress(const uint8_t* d, const uint8_t* end);
+
+extern void fastrgb_list(const uint8_t* d, const uint8_t* end);
+
+// Encode all pads in the 0x5F format, 0 if it needs more than max bytes.
+// With out NULL nothing is written, only the length is worked out.
+extern uint16_t fastrgb_compress(uint8_t* out, uint16_t max);
 
 extern void fastrgb_single(uint8_t p, uint8_t r, uint8_t g, uint8_t b);
 
@@ -20,4 +52,38 @@ extern void fastrgb_single_unsafe(uint8_t p, uint8_t r, uint8_t g, uint8_t b);
 
 extern void fastrgb_ableton_single(uint8_t p, uint8_t v);
 
+// Velocity palette used by fastrgb_ableton_single(), stored in G_EE_PALETTE_MODE.
+#define FASTRGB_PALETTE_NOVATION   0
+#define FASTRGB_PALETTE_USER       1
+
+extern void fastrgb_user_palette_write(uint8_t v, uint8_t r, uint8_t g, uint8_t b);
+
+extern void fastrgb_user_palette_reset(void);
+
+#if ENABLE_PAD_EFFECTS > 0
+#include <stdbool.h>
+
+#define FASTRGB_EFFECT_FLASH       0
+#define FASTRGB_EFFECT_PULSE       1
+
+// Start (v > 0) or stop (v == 0) a flash/pulse with palette color v on pad p.
+extern void fastrgb_effect_set(uint8_t p, uint8_t effect, uint8_t v);
+
+// Once per frame: returns true while any pad has an effect, marking those
+// pads dirty whenever the beat phase has moved on.
+extern bool fastrgb_effects_tick(void);
+
+// Draw the effect pads over a copy of g_display_buffer.
+extern void fastrgb_effects_render(uint8_t* frame);
+#endif
+
+#if ENABLE_PAD_FADES > 0
+// Once per frame: move fading pads along in g_display_buffer.
+extern void fastrgb_fades_tick(void);
+
+// display_flash_counter is about to go from 'restart' back to 0 (MIDI clock
+// start): keep beat fades where they are.
+extern void fastrgb_fades_rebase(uint16_t restart);
+#endif
+
 #endif
@@ -31,11 +31,39 @@
 
 // Globals ---------------------------------------------------------------------
 
-uint64_t g_key_debounce_buffer[DEBOUNCE_BUFFER_SIZE]; // The debounce buffer
-uint64_t g_key_state = 0;      // Current state of the keys after debounce.
-uint64_t g_key_prev_state = 0; // State of the keys when last polled.
-uint64_t g_key_up = 0;         // Key was released since last poll.
-uint64_t g_key_down= 0;       // Key was pressed since last poll.
+// Debounce state, only written by the Timer0 ISR. Each key has a 4-bit
+// count of consecutive scans that disagreed with its debounced state, stored
+// "vertically": bit n of every key's count lives in s_key_count[row][n].
+static volatile uint8_t s_key_debounced[KEY_ROWS]; // Debounced state, 1 = pressed.
+static uint8_t s_key_count[KEY_ROWS][4];
+
+#if DEBOUNCE_SAMPLES < 1 || DEBOUNCE_SAMPLES > 15
+#error DEBOUNCE_SAMPLES must fit the 4-bit vertical counter (1 to 15)
+#endif
+
+// Keys are kept as eight row bytes, key number (row * 8 + bit). Bit r of
+// the *_rows summaries is set when row r has anything in it, so callers can
+// skip quiet rows without looking at them.
+uint8_t g_key_state[KEY_ROWS];      // Current state of the keys after debounce.
+uint8_t g_key_prev_state[KEY_ROWS]; // State of the keys when last polled.
+uint8_t g_key_up[KEY_ROWS];         // Key was released since last poll.
+uint8_t g_key_down[KEY_ROWS];       // Key was pressed since last poll.
+uint8_t g_key_up_rows = 0;          // Rows with a key up since last poll.
+uint8_t g_key_down_rows = 0;        // Rows with a key down since last poll.
+
+#if ENABLE_TEST_OUT_KEY_SCAN_TIME > 0
+volatile uint8_t g_key_scan_ticks_peak = 0; // longest ISR so far, in Timer0 ticks (256 cycles)
+#endif
+
+#if ENABLE_KEY_EVENT_QUEUE > 0
+// Debounced transitions in the order they happened. The ISR only moves the
+// head and the main loop only moves the tail, so neither side needs to turn
+// interrupts off. Indices run freely and are masked on access.
+static key_event_t s_key_events[KEY_EVENT_QUEUE_SIZE];
+static volatile uint8_t s_key_event_head = 0;
+static volatile uint8_t s_key_event_tail = 0;
+volatile uint16_t g_key_event_overflow_count = 0;
+#endif
 
 volatile uint32_t system_time_ms = 0; // 0 to 65 seconds
 uint32_t last_led_refresh_time_ms = 0;
@@ -66,8 +94,9 @@ void key_setup(void)
     PORTD |= KEY_CLOCK;
     PORTD |= KEY_LATCH;
 
-    // Start the debounce buffer in an empty state.
-    memset(g_key_debounce_buffer, 0, sizeof(g_key_debounce_buffer));
+    // Start the debouncer with every key released.
+    memset((uint8_t*)s_key_debounced, 0, sizeof(s_key_debounced));
+    memset(s_key_count, 0, sizeof(s_key_count));
 
     // Setup TIMER0 to trigger an overflow interrupt 1000 times a second.
     // Our counter is incremented every 256 / 16000000 = 0.000016 seconds.
@@ -90,7 +119,7 @@ void key_setup(void)
     TCNT0 = TIMER_TIMEOUT_1MS;
 	// !review: performance: if TIMER_TIMEOUT was increased to 2ms,
 	// - processor would have a lot more execution time between interrupts
-	// -- note that if you do this DEBOUNCE_BUFFER_SIZE must be cut in half
+	// -- note that if you do this DEBOUNCE_SAMPLES must be cut in half
 	// --- or button delay will be added.
 	
     // Set the Timer0 Overflow Interrupt Enable bit.
@@ -99,10 +128,12 @@ void key_setup(void)
     sei();
 
     // setup the global key state variables to empty values.
-    g_key_state = 0;
-    g_key_prev_state = 0;
-    g_key_up = 0;
-    g_key_down = 0;
+    memset(g_key_state, 0, sizeof(g_key_state));
+    memset(g_key_prev_state, 0, sizeof(g_key_prev_state));
+    memset(g_key_up, 0, sizeof(g_key_up));
+    memset(g_key_down, 0, sizeof(g_key_down));
+    g_key_up_rows = 0;
+    g_key_down_rows = 0;
 }
 
 // Disable the timer interrupt. This is needed during teardown before
@@ -117,11 +148,15 @@ void key_disable(void)
 
 // The key read Interrupt Service Routine (ISR).
 //
+// No cycle counts have been recorded for this or for the event loop in
+// Midifighter_Task, before or after the move to row bytes: both are C, so
+// they depend on the code the compiler produces. ENABLE_TEST_OUT_KEY_SCAN_TIME
+// reports the longest ISR only to the nearest Timer0 tick (256 cycles); for
+// exact figures, count the cycles in the avr-objdump listing of this
+// function, or toggle a spare pin around it and time it on a scope.
+//
 ISR(TIMER0_OVF_vect)
 {
-    // Where to write the next value in the ring buffer.
-    static uint8_t buffer_pos = 0;
-	
     // The counter just overflowed, so reset the counter to the magic number
     // 193 (see above).
     TCNT0 = TIMER_TIMEOUT_1MS;
@@ -131,34 +166,102 @@ ISR(TIMER0_OVF_vect)
 	PORTD |= KEY_LATCH;
 	PORTD &= ~KEY_LATCH;
     // Latching the inputs also presents the first bit to the output
-    // pin. Shift the captured bits back to the CPU.
-	uint64_t value = 0;
-	uint64_t bit = 0x1;
-	for (uint8_t i=0; i<64; i++) {
-        PORTD &= ~KEY_CLOCK;  // clock falling edge does nothing.
-        value |= (PINC & KEY_BIT) ? 0 : bit;
-        bit <<= 1;
-        PORTD |= KEY_CLOCK; // clock works on the rising edge, leave it high after use.		
+    // pin. Shift the captured bits back to the CPU a row byte at a time and
+    // debounce each row as soon as it is in.
+	for (uint8_t row=0; row<KEY_ROWS; row++) {
+		uint8_t value = 0;
+		for (uint8_t i=0; i<8; i++) {
+			PORTD &= ~KEY_CLOCK;  // clock falling edge does nothing.
+			value >>= 1;
+			// Note: MF64 has inverted buttons (compared to 3D), a high input is a pressed key.
+			if (PINC & KEY_BIT) {
+				value |= 0x80;
+			}
+			PORTD |= KEY_CLOCK; // clock works on the rising edge, leave it high after use.
+		}
+
+		// Vertical counter debounce. All eight keys of the row are updated
+		// at once, one bit plane at a time.
+		uint8_t debounced = s_key_debounced[row];
+		uint8_t delta = value ^ debounced; // keys reading against their state
+		uint8_t* count = s_key_count[row];
+
+		// Count up where the key disagrees, restart from zero where it agrees.
+		uint8_t carry = delta;
+		uint8_t match = delta; // ends up set where the count hit DEBOUNCE_SAMPLES
+		for (uint8_t n = 0; n < 4; n++) {
+			uint8_t next = (count[n] ^ carry) & delta;
+			carry &= count[n];
+			count[n] = next;
+			match &= (DEBOUNCE_SAMPLES & (1 << n)) ? next : ~next;
+		}
+
+		uint8_t toggle = match;
+		#if ENABLE_KEY_DEBOUNCE_EAGER > 0
+		toggle |= value & ~debounced; // a press counts on the first scan
+		#endif
+		if (toggle) {
+			#if ENABLE_KEY_EVENT_QUEUE > 0
+			// Every change of debounced state is queued. A key whose event
+			// doesn't fit keeps its old state and is held one scan short of
+			// DEBOUNCE_SAMPLES, so it changes on a later scan once there is
+			// room. A press or release can be late, but never lost.
+			uint8_t head = s_key_event_head;
+			uint8_t held = 0;
+			uint8_t key_bit = 0x01;
+			for (uint8_t key = row*8; key_bit; ++key, key_bit <<= 1) {
+				if (!(toggle & key_bit)) {
+					continue;
+				}
+				if ((uint8_t)(head - s_key_event_tail) >= KEY_EVENT_QUEUE_SIZE) {
+					held |= key_bit;
+					continue;
+				}
+				key_event_t* event = &s_key_events[head & (KEY_EVENT_QUEUE_SIZE - 1)];
+				event->key = (debounced & key_bit) ? key : (key | KEY_EVENT_PRESSED);
+				event->time_ms = (uint16_t)system_time_ms;
+				head += 1;
+			}
+			s_key_event_head = head;
+			if (held) {
+				g_key_event_overflow_count += 1;
+				toggle &= ~held;
+				for (uint8_t n = 0; n < 4; n++) {
+					count[n] &= ~held;
+					if ((DEBOUNCE_SAMPLES - 1) & (1 << n)) {
+						count[n] |= held;
+					}
+				}
+			}
+			#endif
+
+			s_key_debounced[row] = debounced ^ toggle;
+			for (uint8_t n = 0; n < 4; n++) {
+				count[n] &= ~toggle;
+			}
+		}
+	}
+
+	#if ENABLE_TEST_OUT_KEY_SCAN_TIME > 0
+	uint8_t ticks = TCNT0 - TIMER_TIMEOUT_1MS;
+	if (ticks > g_key_scan_ticks_peak) {
+		g_key_scan_ticks_peak = ticks;
 	}
-    g_key_debounce_buffer[buffer_pos] = ~value; // Note: MF64 has inverted buttons (compared to 3D). Only logically matters right here! '~'
-    buffer_pos = (buffer_pos + 1) % DEBOUNCE_BUFFER_SIZE;
+	#endif
 	
 	system_time_ms += 1;
   	return;
 }
 
-// Read the current keystate by reconstructing the key samples from the
-// debounce buffer by ANDing together all the samples. Each bit represents a
-// single sample of one key, so the columns line up to represent that state
-// of a single key over time. The result of this read is stored in the
-// global variable "g_key_state".
+// Take a snapshot of the debounced key state kept up to date by the Timer0
+// ISR. The result of this read is stored in the global variable
+// "g_key_state". The debouncing itself happens one scan at a time in the
+// ISR, so this is constant time however often the main loop calls it.
 //
-// NOTE: If any bit is set in the column, the key is considered "activated",
-// so this debouncer is good at recognizing bounces on press/release but
-// doesn't filter or surpress transitory EMF bits. If you've got EMF bits
-// being triggered on a Midifighter, you have bigger problems than
-// debouncing. For more, read Jack Ganssle's short guide to debounce
-// algorithms:
+// With ENABLE_KEY_DEBOUNCE_EAGER a press shows up on the first scan that
+// sees it and only the release has to be stable for DEBOUNCE_SAMPLES scans,
+// so contact bounce after the press can't produce a second note. For more,
+// read Jack Ganssle's short guide to debounce algorithms:
 //
 //     http://www.ganssle.com/debouncing.pdf
 //
@@ -168,12 +271,15 @@ ISR(TIMER0_OVF_vect)
 
 uint32_t key_read(void)
 {
-    // Debounce the keys by ANDing the columns of key samples together.
-    g_key_state = 0xffffffffffffffff;
-    for(uint8_t i=0; i<DEBOUNCE_BUFFER_SIZE; ++i) {
-        g_key_state &= g_key_debounce_buffer[i];
+    // The ISR writes the rows one at a time, don't let it land halfway
+    // through the copy.
+    cli();
+    for (uint8_t row=0; row<KEY_ROWS; ++row) {
+        g_key_state[row] = s_key_debounced[row];
     }
-    return g_key_state;
+    sei();
+    return g_key_state[0] | ((uint32_t)g_key_state[1] << 8) |
+           ((uint32_t)g_key_state[2] << 16) | ((uint32_t)g_key_state[3] << 24);
 }
 
 // Update the key up and key down global variables. We need to separate this
@@ -185,10 +291,46 @@ uint32_t key_read(void)
 //
 void key_calc(void)
 {
-    // If a bit has changed, and it is 1 in the current state, it's a KeyDown.
-	g_key_down = (g_key_prev_state ^ g_key_state) & g_key_state;
-    // If a bit has changed and it was 1 in the previous state, it's a KeyUp.
-    g_key_up = (g_key_prev_state ^ g_key_state) & g_key_prev_state;
-    // Demote the current state to history.
-    g_key_prev_state = g_key_state;
+    g_key_down_rows = 0;
+    g_key_up_rows = 0;
+    for (uint8_t row=0; row<KEY_ROWS; ++row) {
+        uint8_t changed = g_key_prev_state[row] ^ g_key_state[row];
+        // If a bit has changed, and it is 1 in the current state, it's a KeyDown.
+        g_key_down[row] = changed & g_key_state[row];
+        // If a bit has changed and it was 1 in the previous state, it's a KeyUp.
+        g_key_up[row] = changed & g_key_prev_state[row];
+        if (g_key_down[row]) {
+            g_key_down_rows |= (1 << row);
+        }
+        if (g_key_up[row]) {
+            g_key_up_rows |= (1 << row);
+        }
+        // Demote the current state to history.
+        g_key_prev_state[row] = g_key_state[row];
+    }
+}
+
+#if ENABLE_KEY_EVENT_QUEUE > 0
+// Take the oldest key transition off the queue filled by the Timer0 ISR.
+// Returns false when there is nothing waiting.
+//
+bool key_event_read(key_event_t* event)
+{
+    uint8_t tail = s_key_event_tail;
+    if (tail == s_key_event_head) {
+        return false;
+    }
+    *event = s_key_events[tail & (KEY_EVENT_QUEUE_SIZE - 1)];
+    s_key_event_tail = tail + 1;
+    return true;
+}
+
+// Throw away every queued key transition. Called from the main loop while
+// the host hasn't configured the device, so it doesn't get a burst of stale
+// notes once it does.
+//
+void key_event_flush(void)
+{
+    s_key_event_tail = s_key_event_head;
 }
+#endif
@@ -30,14 +30,29 @@
 
 // Extern Globals --------------------------------------------------------------
 
-// The key debounce buffer.
-extern uint64_t g_key_debounce_buffer[DEBOUNCE_BUFFER_SIZE];
+// The key states (after debounce), one byte per row of eight keys.
+#define KEY_ROWS 8
+extern uint8_t g_key_state[KEY_ROWS];      // Current state of the keys.
+extern uint8_t g_key_prev_state[KEY_ROWS]; // State of the keys when last polled.
+extern uint8_t g_key_up[KEY_ROWS];         // Key was released since last poll.
+extern uint8_t g_key_down[KEY_ROWS];       // Key was pressed since last poll.
+extern uint8_t g_key_up_rows;              // Bit per row that has a key up.
+extern uint8_t g_key_down_rows;            // Bit per row that has a key down.
 
-// The key states (after debounce).
-extern uint64_t g_key_state;      // Current state of the keys.
-extern uint64_t g_key_prev_state; // State of the keys when last polled.
-extern uint64_t g_key_up;         // Key was released since last poll.
-extern uint64_t g_key_down;       // Key was pressed since last poll.
+#if ENABLE_TEST_OUT_KEY_SCAN_TIME > 0
+extern volatile uint8_t g_key_scan_ticks_peak;
+#endif
+
+#if ENABLE_KEY_EVENT_QUEUE > 0
+// One debounced key transition, as queued by the Timer0 ISR.
+typedef struct {
+	uint8_t key;      // key number 0-63, with KEY_EVENT_PRESSED set for a press
+	uint16_t time_ms; // low 16 bits of system_time_ms when it was debounced
+} key_event_t;
+#define KEY_EVENT_PRESSED 0x80
+
+extern volatile uint16_t g_key_event_overflow_count; // scans that held a key change back because the queue was full
+#endif
 
 extern volatile uint32_t system_time_ms; // 0 to 65 seconds
 extern uint32_t last_led_refresh_time_ms;
@@ -50,5 +65,9 @@ void key_setup(void);
 void key_disable(void);
 uint32_t key_read(void);
 void key_calc(void);
+#if ENABLE_KEY_EVENT_QUEUE > 0
+bool key_event_read(key_event_t* event);
+void key_event_flush(void);
+#endif
 
 #endif // _KEY_H_INCLUDED
@@ -21,6 +21,7 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 	*/
 
+#include <avr/pgmspace.h>
 #include "led.h"
 //#include "constants.h" // imported in led.h
 #include "random.h"
@@ -235,10 +236,12 @@ void led_set_state_dfu(void)
 	sei();	
 	#elif LED_CONFIGURATION == LED_CONFIGURATION_FOUR_STRANDS
 	// ===== Production Units ====
-	const uint8_t indicator_states[48] = {
+	static const uint8_t indicator_pattern[48] PROGMEM = {
 	48,0,0,    0,0,0,   48,0,0,   0,0,0,  0,0,0,  48,0,0, 0,0,0, 48,0,0,
 	48,0,0,    0,0,0,   48,0,0,   0,0,0,  0,0,0,  48,0,0, 0,0,0, 48,0,0
 	}; 
+	uint8_t indicator_states[48];
+	memcpy_P(indicator_states, indicator_pattern, sizeof(indicator_states));
 	DDRC |= LED_ASYNC_GROUP1; // !review: overkill?
 	DDRB |= LED_ASYNC_GROUP0 | LED_ASYNC_GROUP2 | LED_ASYNC_GROUP3; // !review: overkill?
 	cli();
@@ -312,189 +315,299 @@ void led_update_pixels(uint8_t *buffer)
 	//_delay_us(100);	
 	return;
 }
+
+void led_update_strands(uint8_t *buffer, const uint8_t *buttons)
+{
+	led_update_pixels(buffer); // one strand, always sent whole
+}
 #elif LED_CONFIGURATION == LED_CONFIGURATION_FOUR_STRANDS
 // Four strands
 
-//volatile uint8_t *led_group_ports[4] = {&PORTB, &PORTC, &PORTB, &PORTB};
-//uint8_t led_group_masks[4] = {LED_ASYNC_GROUP0, LED_ASYNC_GROUP1, LED_ASYNC_GROUP2, LED_ASYNC_GROUP3};
+// Send the first 'buttons' buttons (up to 16, two LEDs each) of a strand
+// from 'buffer' to the WS2812 strand on 'pin' of 'port'. Each button has two
+// LEDs that show the same color. The bytes of each LED go out as buffer[2],
+// buffer[1], buffer[0], MSB first, which is the order the original code
+// produced by reading the buffer through a little endian uint32_t. LEDs past
+// the last one sent keep their color.
+//
+// Strands sent one at a time go through this loop. The parallel PORTB path
+// (led_update_pixel_groups_portb(), on with ENABLE_LED_PARALLEL_PORTB) is
+// its own asm loop with the same high times. The whole loop is one asm
+// block, so the timing is fixed by the instruction sequence. At 16MHz
+// (62.5ns per cycle) one bit is:
+//
+//     mov  v, lo           1   value for the middle of the bit:
+//     sbrc byte, 7         1/2 hi for a 1, lo for a 0 (3 cycles either way)
+//     mov  v, hi           1
+//     st   port, hi        2   line goes high
+//     st   port, v         2   0 bit: high for 2 cycles (125ns)
+//     lsl  byte            1
+//     nop                  1
+//     st   port, lo        2   1 bit: high for 6 cycles (375ns)
+//     nop                  1
+//     dec  bits            1
+//     brne next_bit        2
+//
+// A bit is 15 cycles (0.94us). Between bits of a byte the line is low for 9
+// cycles (562.5ns) after a 1 and 13 cycles (812.5ns) after a 0. Loading the
+// next byte makes that 14 cycles (875ns) at a byte boundary, and moving the
+// pointer on makes it at most 22 cycles (1.375us) between LEDs.
+//
+// Against the WS2812B datasheet (T0H 0.4us, T1H 0.8us, T0L 0.85us, T1L
+// 0.45us, each +-150ns; reset after >= 50us low):
+// - The high times are below T0H and T1H. They are the pulses the original
+//   code (sbi, 4 nops, cbi) shipped with, and its notes say a 4 cycle
+//   (250ns) high already reads as a 1 on the PORTB strands, so the fitted
+//   LEDs sample well before the datasheet's T0H and a datasheet length 0 bit
+//   would come out as a 1.
+// - T0L and T1L are met (at least 812.5ns and 562.5ns).
+// - The longest low inside a push is 1.375us, well under the 50us reset and
+//   the few us after which some WS2812 parts already latch.
+//
+// 'st' is used instead of 'out' so the port can be passed in at run time;
+// it is 2 cycles either way. Interrupts must be off while this runs.
+//
+static void led_update_pixel_group(volatile uint8_t *port, uint8_t pin, uint8_t *buffer, uint8_t buttons)
+{
+	const uint8_t lo = *port & ~pin;
+	const uint8_t hi = lo | pin;
+
+	// The pointer starts one past the button's last byte and walks down it
+	// with pre-decrement.
+	uint8_t *data = buffer + 3;
+	uint8_t leds = buttons * 2;
+	uint8_t bytes, bits, byte, v;
+
+	asm volatile(
+		"1:"                         "\n\t"
+		"ldi  %[bytes], 3"           "\n\t"
+		"2:"                         "\n\t"
+		"ld   %[byte], -%a[data]"    "\n\t"
+		"ldi  %[bits], 8"            "\n\t"
+		"3:"                         "\n\t"
+		"mov  %[v], %[lo]"           "\n\t"
+		"sbrc %[byte], 7"            "\n\t"
+		"mov  %[v], %[hi]"           "\n\t"
+		"st   %a[port], %[hi]"       "\n\t" // data is latched on rising edge
+		"st   %a[port], %[v]"        "\n\t" // 0 bits end here (2 cycles)
+		"lsl  %[byte]"               "\n\t"
+		"nop"                        "\n\t"
+		"st   %a[port], %[lo]"       "\n\t" // 1 bits end here (6 cycles)
+		"nop"                        "\n\t"
+		"dec  %[bits]"               "\n\t"
+		"brne 3b"                    "\n\t"
+		"dec  %[bytes]"              "\n\t"
+		"brne 2b"                    "\n\t"
+		"adiw %a[data], 3"           "\n\t" // back to the end of this button
+		"sbrc %[leds], 0"            "\n\t" // leds is odd after a button's second LED
+		"adiw %a[data], 3"           "\n\t" // on to the end of the next button
+		"dec  %[leds]"               "\n\t"
+		"brne 1b"                    "\n\t"
+		: [data] "+z" (data), [leds] "+r" (leds),
+		  [bytes] "=&d" (bytes), [bits] "=&d" (bits),
+		  [byte] "=&r" (byte), [v] "=&r" (v)
+		: [port] "x" (port), [hi] "r" (hi), [lo] "r" (lo)
+		: "memory"
+	);
+}
+
 void led_update_pixel_group0(uint8_t *buffer)
 {
-		//volatile uint8_t *this_port = led_group_ports[group_id];
-		//uint8_t port_bit_flag = led_group_masks[group_id];
-	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;
-	// Turn off interrupts for a moment.
-	//cli();
-	for (uint8_t this_led=0; this_led <= 31; this_led++) {
-		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
-		test_buffer = *single_led_buffer;
-		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
-			buffer = buffer + 3;
-		}
-		// Set individual LED States
-		uint32_t this_mask = 0x800000;
-		for (uint8_t this_bit=0; this_bit < 24; this_bit++) {
-			//uint32_t this_value = test_buffer & this_mask; // !review: remove test_buffer?
-			// Transmit this one bit
-			if (test_buffer & this_mask) { // High Bit
-				PORTB |= LED_ASYNC_GROUP0;  // Set Port Value to 1 (data is latched on rising edge).
-				//_delay_us(0.8);		// Spec, Wait 0.8us, two "nop"s works, and takes less time
-				asm("nop");
-				asm("nop");
-				asm("nop");
-				asm("nop");
-				PORTB &= ~LED_ASYNC_GROUP0;  // Set Port Value to 0
-				//_delay_us(0.40); //  Spec, but proved unnecessary
-			}
-			else { // Low Bit
-				// Set Port Value to 1
-				PORTB |= LED_ASYNC_GROUP0;  // data is latched on rising edge.
-				//_delay_us(0.10); 	// Spec, was Wait 0.4us, but proved unnecessary
-				PORTB &= ~LED_ASYNC_GROUP0;  // Set Port Value to 0
-				//_delay_us(0.8);  // Spec, was Wait 0.85us but proved unnecessary
-			}
-			this_mask >>= 1;
-		}
-	}
-	//sei(); // Re-Enable Interrupts
-	return;
+	led_update_pixel_group(&PORTB, LED_ASYNC_GROUP0, buffer, 16);
 }
 
-void led_update_pixel_group1(uint8_t *buffer) 
+void led_update_pixel_group1(uint8_t *buffer)
 {
-	//DDRC |= LED_ASYNC;
-	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;	
-	// Turn off interrupts for a moment.
-	//cli();
-	for (uint8_t this_led=0; this_led <= 31; this_led++) {
-		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
-		test_buffer = *single_led_buffer;
-		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
-			buffer = buffer + 3;
-		}
-		// Set individual LED States
-		uint32_t this_mask = 0x800000;
-		for (uint8_t this_bit=0; this_bit < 24; this_bit++) {
-			// Transmit this one bit
-			if (test_buffer & this_mask) { // High Bit
-				PORTC |= LED_ASYNC_GROUP1;  // Set Port Value to 1 (data is latched on rising edge).
-				//_delay_us(0.8);		// LED Spec, Wait 0.8us, two "nop"s works, and takes less time
-				asm("nop"); // !review: group1 requires 4 nops, portB ports only require 2... why?
-				asm("nop");
-				asm("nop");
-				asm("nop");				
-				PORTC &= ~LED_ASYNC_GROUP1;  // Set Port Value to 0
-				//_delay_us(0.40); //  Spec, but proved unnecessary 
-			}
-			else { // Low Bit
-				// Set Port Value to 1
-				PORTC |= LED_ASYNC_GROUP1;  // data is latched on rising edge.
-				//_delay_us(0.10); 	// Spec, was Wait 0.4us, but proved unnecessary
-				PORTC &= ~LED_ASYNC_GROUP1;  // Set Port Value to 0
-				//_delay_us(0.8);  // Spec, was Wait 0.85us but proved unnecessary
-			}
-			this_mask >>= 1;
-		}
-	}
-	//sei(); // Re-Enable Interrupts
-	return;
+	led_update_pixel_group(&PORTC, LED_ASYNC_GROUP1, buffer, 16);
 }
 
 void led_update_pixel_group2(uint8_t *buffer)
 {
-	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;
-	// Turn off interrupts for a moment.
-	//cli();
-	for (uint8_t this_led=0; this_led <= 31; this_led++) {
-		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
-		test_buffer = *single_led_buffer;
-		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
-			buffer = buffer + 3;
-		}
-		// Set individual LED States
-		uint32_t this_mask = 0x800000;
-		for (uint8_t this_bit=0; this_bit < 24; this_bit++) {
-			// Transmit this one bit
-			if (test_buffer & this_mask) { // High Bit
-				PORTB |= LED_ASYNC_GROUP2;  // Set Port Value to 1 (data is latched on rising edge).
-				//_delay_us(0.8);		// LED Spec, Wait 0.8us, two "nop"s works, and takes less time
-				asm("nop");
-				asm("nop");
-				asm("nop");
-				asm("nop");
-				PORTB &= ~LED_ASYNC_GROUP2;  // Set Port Value to 0
-				//_delay_us(0.40); //  Spec, but proved unnecessary
-			}
-			else { // Low Bit
-				// Set Port Value to 1
-				PORTB |= LED_ASYNC_GROUP2;  // data is latched on rising edge.
-				//_delay_us(0.10); 	// Spec, was Wait 0.4us, but proved unnecessary
-				PORTB &= ~LED_ASYNC_GROUP2;  // Set Port Value to 0
-				//_delay_us(0.8);  // Spec, was Wait 0.85us but proved unnecessary
-			}
-			this_mask >>= 1;
-		}
-	}
-	//sei(); // Re-Enable Interrupts
-	return;
+	led_update_pixel_group(&PORTB, LED_ASYNC_GROUP2, buffer, 16);
 }
 
 void led_update_pixel_group3(uint8_t *buffer)
 {
-	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;
-	// Turn off interrupts for a moment.
-	//cli();
-	for (uint8_t this_led=0; this_led <= 31; this_led++) {
-		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
-		test_buffer = *single_led_buffer;
-		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
-			buffer = buffer + 3;
-		}
-		// Set individual LED States
-		uint32_t this_mask = 0x800000;
-		for (uint8_t this_bit=0; this_bit < 24; this_bit++) {
-			// Transmit this one bit
-			if (test_buffer & this_mask) { // High Bit
-				PORTB |= LED_ASYNC_GROUP3;  // Set Port Value to 1 (data is latched on rising edge).
-				//_delay_us(0.8);		// led Spec, Wait 0.8us, "nop"s works, and takes less time
-				asm("nop");
-				asm("nop");
-				asm("nop");
-				asm("nop");
-				PORTB &= ~LED_ASYNC_GROUP3;  // Set Port Value to 0
-				//_delay_us(0.40); //  Spec, but proved unnecessary
-			}
-			else { // Low Bit
-				// Set Port Value to 1
-				PORTB |= LED_ASYNC_GROUP3;  // data is latched on rising edge.
-				//_delay_us(0.10); 	// Spec, was Wait up to 0.4us, but proved unnecessary
-				PORTB &= ~LED_ASYNC_GROUP3;  // Set Port Value to 0
-				//_delay_us(0.8);  // Spec, was Wait up to 0.85us but proved unnecessary
-			}
-			this_mask >>= 1;
-		}
-	}
-	//sei(); // Re-Enable Interrupts
+	led_update_pixel_group(&PORTB, LED_ASYNC_GROUP3, buffer, 16);
+}
+
+// Groups 0, 2 and 3 all live on PORTB, so send them at the same time: every
+// bit slot raises all three pins, drops the pins whose bit is 0, then drops
+// the rest. That's one PORTB write per phase for three LEDs instead of a
+// sbi/cbi pair per LED, so the three strands take about as long as one.
+//
+// 'buffer' is the whole display buffer; the strands start at buffer,
+// buffer + 96 and buffer + 144, and all three get the first 'buttons'
+// buttons. Bytes go out in the same order as the group functions read them
+// through their uint32_t cast: buffer[2], buffer[1], buffer[0], MSB first,
+// twice per button (two LEDs showing the same color).
+//
+// The whole loop is one asm block so every low time is fixed too. At 16MHz
+// (62.5ns per cycle) one bit slot is:
+//
+//     mov  data, lo        1   PORTB value for the middle of the slot:
+//     bst  v0, 7           1   each strand's pin copied from the MSB
+//     bld  data, GROUP0    1   of its current byte
+//     bst  v2, 7           1
+//     bld  data, GROUP2    1
+//     bst  v3, 7           1
+//     bld  data, GROUP3    1
+//     out  PORTB, hi       1   all three lines go high
+//     nop                  1
+//     out  PORTB, data     1   0 bits: high for 2 cycles (125ns)
+//     lsl  v0              1
+//     lsl  v2              1
+//     lsl  v3              1
+//     out  PORTB, lo       1   1 bits: high for 6 cycles (375ns)
+//     dec  bits            1
+//     brne next_bit        2
+//
+// A slot is 17 cycles (1.06us). Between bits of a byte a line is low for 11
+// cycles (687.5ns) after a 1 and 15 cycles (937.5ns) after a 0. Loading the
+// next three bytes stretches that to 20 cycles (1.25us) at a byte boundary,
+// and moving the pointers on makes it at most 33 cycles (2.06us) between
+// LEDs.
+//
+// Against the WS2812B datasheet (T0H 0.4us, T1H 0.8us, T0L 0.85us, T1L
+// 0.45us, each +-150ns; reset after >= 50us low):
+// - The high times are below T0H and T1H. They are the pulses the original
+//   code (sbi, 4 nops, cbi) shipped with, and its notes say a 4 cycle
+//   (250ns) high already reads as a 1 on the PORTB strands, so the fitted
+//   LEDs sample well before the datasheet's T0H and a datasheet length 0 bit
+//   would come out as a 1. The 0 bit stays at the proven 2 cycles.
+// - T0L and T1L are met with room to spare (at least 937.5ns and 687.5ns).
+// - The longest low inside a push is 2.06us, well under the 50us reset and
+//   the few us after which some WS2812 parts already latch.
+//
+// Interrupts must be off while this runs.
+//
+void led_update_pixel_groups_portb(uint8_t *buffer, uint8_t buttons)
+{
+	// Leave the other PORTB pins as they are. Nothing else writes PORTB while
+	// interrupts are off, so one read is enough for the whole push.
+	const uint8_t lo = PORTB & ~(LED_ASYNC_GROUP0 | LED_ASYNC_GROUP2 | LED_ASYNC_GROUP3);
+	const uint8_t hi = lo | LED_ASYNC_GROUP0 | LED_ASYNC_GROUP2 | LED_ASYNC_GROUP3;
+
+	// Both pointers start one past the button's last byte and walk down it
+	// with pre-decrement. Strand 3 is read from strand 2's pointer + 48.
+	uint8_t *p0 = buffer + 3;
+	uint8_t *p2 = buffer + 96 + 3;
+	uint8_t leds = buttons * 2;
+	uint8_t bytes, bits, v0, v2, v3, data;
+
+	asm volatile(
+		"1:"                              "\n\t"
+		"ldi  %[bytes], 3"                "\n\t"
+		"2:"                              "\n\t"
+		"ld   %[v0], -%a[p0]"             "\n\t"
+		"ld   %[v2], -%a[p2]"             "\n\t"
+		"ldd  %[v3], %a[p2]+48"           "\n\t"
+		"ldi  %[bits], 8"                 "\n\t"
+		"3:"                              "\n\t"
+		"mov  %[data], %[lo]"             "\n\t"
+		"bst  %[v0], 7"                   "\n\t"
+		"bld  %[data], %[b0]"             "\n\t"
+		"bst  %[v2], 7"                   "\n\t"
+		"bld  %[data], %[b2]"             "\n\t"
+		"bst  %[v3], 7"                   "\n\t"
+		"bld  %[data], %[b3]"             "\n\t"
+		"out  %[port], %[hi]"             "\n\t" // data is latched on rising edge
+		"nop"                             "\n\t"
+		"out  %[port], %[data]"           "\n\t" // 0 bits end here (2 cycles)
+		"lsl  %[v0]"                      "\n\t"
+		"lsl  %[v2]"                      "\n\t"
+		"lsl  %[v3]"                      "\n\t"
+		"out  %[port], %[lo]"             "\n\t" // 1 bits end here (6 cycles)
+		"dec  %[bits]"                    "\n\t"
+		"brne 3b"                         "\n\t"
+		"dec  %[bytes]"                   "\n\t"
+		"brne 2b"                         "\n\t"
+		"adiw %a[p0], 3"                  "\n\t" // back to the end of this button
+		"adiw %a[p2], 3"                  "\n\t"
+		"sbrs %[leds], 0"                 "\n\t" // leds is odd after a button's second LED
+		"rjmp 4f"                         "\n\t"
+		"adiw %a[p0], 3"                  "\n\t" // on to the end of the next button
+		"adiw %a[p2], 3"                  "\n\t"
+		"4:"                              "\n\t"
+		"dec  %[leds]"                    "\n\t"
+		"brne 1b"                         "\n\t"
+		: [p0] "+x" (p0), [p2] "+z" (p2), [leds] "+r" (leds),
+		  [bytes] "=&d" (bytes), [bits] "=&d" (bits),
+		  [v0] "=&r" (v0), [v2] "=&r" (v2), [v3] "=&r" (v3), [data] "=&r" (data)
+		: [port] "I" (_SFR_IO_ADDR(PORTB)), [hi] "r" (hi), [lo] "r" (lo),
+		  [b0] "n" (__builtin_ctz(LED_ASYNC_GROUP0)),
+		  [b2] "n" (__builtin_ctz(LED_ASYNC_GROUP2)),
+		  [b3] "n" (__builtin_ctz(LED_ASYNC_GROUP3))
+		: "memory"
+	);
 	return;
 }
 
-void led_update_pixels(uint8_t *buffer)
+// Send the first buttons[n] buttons of each strand n, and nothing at all
+// for a strand whose count is 0. Strand n is buttons 16n to 16n+15 of the
+// display buffer, i.e. 48 bytes from buffer + 48n.
+//
+void led_update_strands(uint8_t *buffer, const uint8_t *buttons)
 {
 	DDRC |= LED_ASYNC_GROUP1; // !review: we don't need to set this every time
 	DDRB |= LED_ASYNC_GROUP0 | LED_ASYNC_GROUP2 | LED_ASYNC_GROUP3; // !review: we don't need to set this every time
+	#if ENABLE_LED_PARALLEL_PORTB > 0
+	// The parallel strands share their bit slots, so send as far as the
+	// furthest of the three needs. Re-sending an unchanged LED is harmless.
+	uint8_t portb_buttons = buttons[0];
+	if (buttons[2] > portb_buttons) { portb_buttons = buttons[2]; }
+	if (buttons[3] > portb_buttons) { portb_buttons = buttons[3]; }
+	#endif
+	#if LED_PUSH_MODE == LED_PUSH_ATOMIC
 	cli(); // disable interrupts
-	led_update_pixel_group0(buffer); // Test
-	led_update_pixel_group1(buffer+48);
-	led_update_pixel_group2(buffer+96);
-	led_update_pixel_group3(buffer+144);
+	#if ENABLE_LED_PARALLEL_PORTB > 0
+	if (portb_buttons) { led_update_pixel_groups_portb(buffer, portb_buttons); }
+	if (buttons[1]) { led_update_pixel_group(&PORTC, LED_ASYNC_GROUP1, buffer+48, buttons[1]); }
+	#else
+	if (buttons[0]) { led_update_pixel_group(&PORTB, LED_ASYNC_GROUP0, buffer, buttons[0]); }
+	if (buttons[1]) { led_update_pixel_group(&PORTC, LED_ASYNC_GROUP1, buffer+48, buttons[1]); }
+	if (buttons[2]) { led_update_pixel_group(&PORTB, LED_ASYNC_GROUP2, buffer+96, buttons[2]); }
+	if (buttons[3]) { led_update_pixel_group(&PORTB, LED_ASYNC_GROUP3, buffer+144, buttons[3]); }
+	#endif
 	sei(); // reenable interrupts
+	#else
+	// Each strand is finished before interrupts come back on, so a late
+	// interrupt between strands can only delay a strand, never corrupt it.
+	#if ENABLE_LED_PARALLEL_PORTB > 0
+	if (portb_buttons) {
+		cli();
+		led_update_pixel_groups_portb(buffer, portb_buttons);
+		sei();
+	}
+	#else
+	if (buttons[0]) {
+		cli();
+		led_update_pixel_group(&PORTB, LED_ASYNC_GROUP0, buffer, buttons[0]);
+		sei();
+	}
+	if (buttons[2]) {
+		cli();
+		led_update_pixel_group(&PORTB, LED_ASYNC_GROUP2, buffer+96, buttons[2]);
+		sei();
+	}
+	if (buttons[3]) {
+		cli();
+		led_update_pixel_group(&PORTB, LED_ASYNC_GROUP3, buffer+144, buttons[3]);
+		sei();
+	}
+	#endif
+	if (buttons[1]) {
+		cli();
+		led_update_pixel_group(&PORTC, LED_ASYNC_GROUP1, buffer+48, buttons[1]);
+		sei();
+	}
+	#endif
 	return;
 }
+
+void led_update_pixels(uint8_t *buffer)
+{
+	static const uint8_t all_buttons[4] = {16, 16, 16, 16};
+	led_update_strands(buffer, all_buttons);
+}
 #endif // FOUR_STRANDS
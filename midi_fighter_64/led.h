@@ -56,12 +56,14 @@ void led_setup(void);
 void led_disable(void);
 void led_enable(void);
 void led_update_pixels(uint8_t *buffer);
+void led_update_strands(uint8_t *buffer, const uint8_t *buttons);
 
 // for compatibility with original MF code
 void led_update_pixel_group0(uint8_t *buffer);
 void led_update_pixel_group1(uint8_t *buffer);
 void led_update_pixel_group2(uint8_t *buffer);
 void led_update_pixel_group3(uint8_t *buffer);
+void led_update_pixel_groups_portb(uint8_t *buffer, uint8_t buttons);
 void led_set_state(uint16_t new_state, uint32_t color);
 void led_set_state_dfu(void);
 
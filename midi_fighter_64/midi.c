@@ -23,6 +23,7 @@
 
 #include <string.h>  // for memset()
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <stdlib.h>
 #include "constants.h"
 #include "key.h"
@@ -32,6 +33,8 @@
 #include "midi.h"
 #include "led.h"
 #include "eeprom.h"
+#include "fastrgb.h" // for fastrgb_fades_rebase()
+#include "sequence.h" // for sequence_rebase()
 
 
 // Global variables ------------------------------------------------------------
@@ -41,6 +44,18 @@ uint8_t ticks = 0;
 // Interface object for the high level LUFA MIDI Class Drivers. This gets
 // passed into every MIDI call so it can potentially keep track of many
 // interfaces. The Midifighter only needs the one.
+//
+// Both stream endpoints are double banked (MIDI_STREAM_BANKS). With a single
+// bank the controller NAKs the host from the moment a packet lands until the
+// firmware has released it, and every LED push (~4ms with interrupts off)
+// holds the OUT endpoint shut for at most one 16 event packet. With two
+// banks a second packet is accepted during that time, and on the IN side
+// MIDI_Device_Flush() no longer has to wait for the host to collect the
+// packet we just committed. Use ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND to
+// measure events per second in each direction when changing this. No
+// before/after figures have been recorded for the switch to two banks yet:
+// build with MIDI_STREAM_BANKS 1 and 2, stream notes at the device from the
+// host as fast as it will take them, and read CC 12/13 back.
 #if USE_LUFA_2015 > 0
 #define MIDI_STREAM_IN_EPADDR (ENDPOINT_DIR_IN | MIDI_STREAM_IN_EPNUM)
 #define MIDI_STREAM_OUT_EPADDR (ENDPOINT_DIR_OUT | MIDI_STREAM_OUT_EPNUM)
@@ -51,13 +66,13 @@ static USB_ClassInfo_MIDI_Device_t s_midi_interface = {
 		{
 			.Address          = MIDI_STREAM_IN_EPADDR,
 			.Size             = 64, // 64
-			.Banks            = 1, // !review: 0,1,2,+ none has any effect on throughput, why?
+			.Banks            = MIDI_STREAM_BANKS, // MIDI_Device_Flush only waits if both banks are still queued for the host
 		},
 		.DataOUTEndpoint = 
 		{
 			.Address          = MIDI_STREAM_OUT_EPADDR,
 			.Size             = 64, // 64
-			.Banks            = 1,	// !review: 0,1,2,+ none has any effect on throughput, why? Can we set to 3ms, and then read a bunch of messages continuously?
+			.Banks            = MIDI_STREAM_BANKS, // the host fills one bank while USB_COM_vect empties the other
 		},
 	},
 };
@@ -69,10 +84,10 @@ static USB_ClassInfo_MIDI_Device_t s_midi_interface = {
         .StreamingInterfaceNumber = 1,
         .DataINEndpointNumber      = MIDI_STREAM_IN_EPNUM,
         .DataINEndpointSize        = MIDI_STREAM_EPSIZE,
-        .DataINEndpointDoubleBank  = false,
+        .DataINEndpointDoubleBank  = (MIDI_STREAM_BANKS > 1),
         .DataOUTEndpointNumber     = MIDI_STREAM_OUT_EPNUM,
         .DataOUTEndpointSize       = MIDI_STREAM_EPSIZE,
-        .DataOUTEndpointDoubleBank = false,
+        .DataOUTEndpointDoubleBank = (MIDI_STREAM_BANKS > 1),
     },
 };
 #endif 
@@ -113,6 +128,47 @@ uint8_t g_midi_note_off_counter[NUM_BUTTONS]; //  0-63 are bank 1
 bool g_midi_sysex_is_reading = false;
 bool g_midi_sysex_is_valid = false;
 
+#if ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND > 0
+uint16_t g_midi_tx_event_count = 0; // events queued for the host since the last report
+#endif
+
+#if ENABLE_MIDI_TX_NONBLOCKING > 0
+// Outgoing events waiting for a free IN bank. Only the main loop touches
+// the queue. Indices run freely and are masked on access.
+#define MIDI_TX_EVENTS_PER_BANK (MIDI_STREAM_EPSIZE / sizeof(MIDI_EventPacket_t))
+static MIDI_EventPacket_t s_midi_tx_queue[MIDI_TX_QUEUE_SIZE];
+static uint8_t s_midi_tx_head = 0;
+static uint8_t s_midi_tx_tail = 0;
+static bool s_midi_tx_host_gone = false; // a wait for room timed out, don't wait again until a bank goes out
+uint16_t g_midi_tx_merge_count = 0; // events merged away because the queue was full
+uint16_t g_midi_tx_drop_count = 0;  // events dropped because the queue was full
+#elif ENABLE_MIDI_TX_BATCHING > 0
+// Outgoing events waiting to be committed to the IN endpoint. One endpoint
+// bank's worth, so a full buffer goes out as exactly one USB packet.
+#define MIDI_TX_BUFFER_SIZE (MIDI_STREAM_EPSIZE / sizeof(MIDI_EventPacket_t))
+static MIDI_EventPacket_t s_midi_tx_buffer[MIDI_TX_BUFFER_SIZE];
+static uint8_t s_midi_tx_count = 0;
+#endif
+
+#if USB_RX_METHOD == USB_RX_INTERRUPT
+#if USE_LUFA_2015 <= 0
+#error USB_RX_INTERRUPT requires USE_LUFA_2015
+#endif
+#if USB_RX_RING_SIZE < MIDI_STREAM_EPSIZE / 4
+#error USB_RX_RING_SIZE must hold at least one full OUT bank
+#endif
+// Single producer (USB_COM_vect) / single consumer (main loop) ring of
+// received USB-MIDI events. The ISR only ever writes the head and the main
+// loop only ever writes the tail, so neither side needs to lock the other
+// out. Indices run freely and are masked on access.
+static MIDI_EventPacket_t s_midi_rx_ring[USB_RX_RING_SIZE];
+static volatile uint8_t s_midi_rx_ring_head = 0;
+static volatile uint8_t s_midi_rx_ring_tail = 0;
+static volatile bool s_midi_rx_ring_stalled = false; // OUT interrupt masked until the ring drains
+volatile uint16_t g_midi_rx_ring_overflow_count = 0;
+volatile uint8_t g_midi_rx_ring_peak = 0;
+#endif
+
 // MIDI functions -------------------------------------------------------------
 
 // Initialize the MIDI key state.
@@ -124,8 +180,266 @@ void midi_setup(void)
     // basenote, expnote, channel and velocity have already been set up via
     // the EEPROM settings. Clear the MIDI keystate.
     memset(g_midi_note_off_counter, 0, sizeof(g_midi_note_off_counter)); // review: why do we have two*MIDI_MAX_NOTES, but only save one. Is one unused?
+
+#if ENABLE_TEST_OUT_USB_TX_MERGE > 0 && ENABLE_MIDI_TX_NONBLOCKING > 0
+    midi_tx_merge_test();
+#endif
+}
+
+#if ENABLE_MIDI_TX_NONBLOCKING > 0
+// The queue is full and another event needs to go in. First try to make
+// room by merging with the newest queued event of the same kind, channel
+// and number: a NoteOff cancels a NoteOn the host hasn't seen yet, and a CC
+// overwrites the last value still queued for that controller. Older events
+// are never touched, so the host always ends up in the same state as if
+// nothing had been merged. Only called under pressure, so a quick tap is
+// never merged away while the host is keeping up. Returns true if the new
+// event has been dealt with.
+static bool midi_tx_merge(const MIDI_EventPacket_t* event)
+{
+	uint8_t status = event->Data1 & 0xF0;
+	bool note_off = (status == 0x80) || (status == 0x90 && event->Data3 == 0);
+
+	if (!note_off && status != 0xB0) {
+		return false;
+	}
+
+	for (uint8_t i = s_midi_tx_head; i != s_midi_tx_tail; ) {
+		i -= 1;
+		MIDI_EventPacket_t* queued = &s_midi_tx_queue[i & (MIDI_TX_QUEUE_SIZE - 1)];
+		uint8_t queued_status = queued->Data1 & 0xF0;
+		if ((queued->Data1 & 0x0F) != (event->Data1 & 0x0F) || queued->Data2 != event->Data2) {
+			continue;
+		}
+
+		if (status == 0xB0) {
+			if (queued_status != 0xB0) {
+				continue;
+			}
+			queued->Data3 = event->Data3;
+			g_midi_tx_merge_count += 1;
+			return true;
+		}
+
+		if (queued_status != 0x80 && queued_status != 0x90) {
+			continue;
+		}
+		if (queued_status == 0x80 || queued->Data3 == 0) {
+			return false; // the newest is already a NoteOff
+		}
+		// Close the gap left by the NoteOn, keeping the queue in order.
+		for (uint8_t j = i; (uint8_t)(j + 1) != s_midi_tx_head; j++) {
+			s_midi_tx_queue[j & (MIDI_TX_QUEUE_SIZE - 1)] =
+				s_midi_tx_queue[(j + 1) & (MIDI_TX_QUEUE_SIZE - 1)];
+		}
+		s_midi_tx_head -= 1;
+		g_midi_tx_merge_count += 2;
+		return true;
+	}
+	return false;
+}
+
+// USB-MIDI code index numbers 0x4 to 0x7 carry SysEx.
+static bool midi_tx_is_sysex(const MIDI_EventPacket_t* event)
+{
+	#if USE_LUFA_2015 > 0
+	uint8_t cin = event->Event & 0x0F;
+	#else
+	uint8_t cin = event->Command;
+	#endif
+	return cin >= 0x4 && cin <= 0x7;
+}
+
+// Drop the oldest queued event that isn't part of a SysEx message, moving
+// the events before it up so the queue stays in order. Returns false if the
+// queue holds nothing but SysEx.
+static bool midi_tx_drop_voice(void)
+{
+	for (uint8_t i = s_midi_tx_tail; i != s_midi_tx_head; i++) {
+		if (midi_tx_is_sysex(&s_midi_tx_queue[i & (MIDI_TX_QUEUE_SIZE - 1)])) {
+			continue;
+		}
+		for (uint8_t j = i; j != s_midi_tx_tail; j--) {
+			s_midi_tx_queue[j & (MIDI_TX_QUEUE_SIZE - 1)] =
+				s_midi_tx_queue[(uint8_t)(j - 1) & (MIDI_TX_QUEUE_SIZE - 1)];
+		}
+		s_midi_tx_tail += 1;
+		g_midi_tx_drop_count += 1;
+		return true;
+	}
+	return false;
+}
+
+// Keep flushing until one more event fits, for at most
+// MIDI_TX_FLUSH_TIMEOUT_MS. After a wait has timed out the host is taken to
+// be gone and later calls return at once, until midi_flush() gets a bank out
+// again, so a long SysEx reply to a host that isn't reading costs one
+// timeout rather than one per packet.
+static void midi_tx_wait_for_room(void)
+{
+	uint32_t start_time_ms = system_time_ms;
+	while (!s_midi_tx_host_gone &&
+	       (uint8_t)(s_midi_tx_head - s_midi_tx_tail) >= MIDI_TX_QUEUE_SIZE) {
+		midi_flush();
+		if ((system_time_ms - start_time_ms) >= MIDI_TX_FLUSH_TIMEOUT_MS) {
+			s_midi_tx_host_gone = true;
+		}
+	}
+}
+#elif ENABLE_MIDI_TX_BATCHING > 0
+// Write everything in the transmit buffer to the IN endpoint in one stream
+// write, instead of re-checking the device state, reselecting the endpoint
+// and starting a 4-byte write for every event. If that fills the bank it is
+// handed to the controller, otherwise it waits for MIDI_Device_Flush().
+static void midi_tx_commit(void)
+{
+	if (s_midi_tx_count == 0) {
+		return;
+	}
+
+	if (USB_DeviceState == DEVICE_STATE_Configured) {
+		Endpoint_SelectEndpoint(g_midi_interface_info->Config.DataINEndpoint.Address);
+		Endpoint_Write_Stream_LE(s_midi_tx_buffer,
+		                         s_midi_tx_count * sizeof(MIDI_EventPacket_t),
+		                         NULL);
+		if (!(Endpoint_IsReadWriteAllowed())) {
+			Endpoint_ClearIN();
+		}
+	}
+
+	s_midi_tx_count = 0;
+}
+#endif
+
+// Queue one USB-MIDI event for the IN endpoint. Every midi_stream_*()
+// function funnels through here. With ENABLE_MIDI_TX_NONBLOCKING or
+// ENABLE_MIDI_TX_BATCHING the event is only staged in RAM; it reaches the
+// endpoint on the next midi_flush() (or, when batching, as soon as a full
+// bank's worth of events is waiting).
+static void midi_send_event(const MIDI_EventPacket_t* event)
+{
+	#if ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND > 0
+	g_midi_tx_event_count += 1;
+	#endif
+	#if ENABLE_MIDI_TX_NONBLOCKING > 0
+	if ((uint8_t)(s_midi_tx_head - s_midi_tx_tail) >= MIDI_TX_QUEUE_SIZE) {
+		// A channel voice event never waits: it is merged, or it pushes
+		// out the oldest queued voice event. SysEx is never dropped to make
+		// room, losing one packet would corrupt the whole message, so a
+		// SysEx packet (or a voice event stuck behind a queue full of SysEx)
+		// waits for the host instead, for a bounded time.
+		bool sysex = midi_tx_is_sysex(event);
+		if (!sysex && midi_tx_merge(event)) {
+			return;
+		}
+		if (sysex || !midi_tx_drop_voice()) {
+			midi_tx_wait_for_room();
+			if ((uint8_t)(s_midi_tx_head - s_midi_tx_tail) >= MIDI_TX_QUEUE_SIZE) {
+				g_midi_tx_drop_count += 1; // the host isn't reading
+				return;
+			}
+		}
+	}
+	s_midi_tx_queue[s_midi_tx_head & (MIDI_TX_QUEUE_SIZE - 1)] = *event;
+	s_midi_tx_head += 1;
+	#elif ENABLE_MIDI_TX_BATCHING > 0
+	s_midi_tx_buffer[s_midi_tx_count++] = *event;
+	if (s_midi_tx_count >= MIDI_TX_BUFFER_SIZE) {
+		midi_tx_commit();
+	}
+	#else
+	MIDI_Device_SendEventPacket(g_midi_interface_info, event);
+	#endif
+}
+
+#if ENABLE_TEST_OUT_USB_TX_MERGE > 0 && ENABLE_MIDI_TX_NONBLOCKING > 0
+// Hooks for the power-on check in midi_test.c, which needs to see into the
+// transmit queue.
+void midi_tx_test_send(const MIDI_EventPacket_t* event)
+{
+	midi_send_event(event);
+}
+
+void midi_tx_test_clear(void)
+{
+	s_midi_tx_head = s_midi_tx_tail = 0;
+	g_midi_tx_merge_count = 0;
+	g_midi_tx_drop_count = 0;
 }
 
+uint8_t midi_tx_test_count(void)
+{
+	return s_midi_tx_head - s_midi_tx_tail;
+}
+
+// The n-th newest queued event, 0 being the last one queued.
+const MIDI_EventPacket_t* midi_tx_test_newest(uint8_t n)
+{
+	return &s_midi_tx_queue[(uint8_t)(s_midi_tx_head - 1 - n) & (MIDI_TX_QUEUE_SIZE - 1)];
+}
+#endif
+
+#if ENABLE_MIDI_TX_NONBLOCKING > 0
+// Hand as many queued events to the host as there are free IN banks, one
+// USB packet per bank, and return without waiting. Whatever doesn't fit
+// stays queued for the next call. Unlike MIDI_Device_Flush() this never
+// waits for the host, so a port nobody is reading (e.g. the DAW hasn't
+// opened it yet) can't stall the LEDs and key scanning.
+//
+void midi_flush(void)
+{
+	if (USB_DeviceState != DEVICE_STATE_Configured) {
+		return;
+	}
+
+	Endpoint_SelectEndpoint(g_midi_interface_info->Config.DataINEndpoint.Address);
+
+	while (s_midi_tx_tail != s_midi_tx_head && Endpoint_IsINReady()) {
+		for (uint8_t n = 0; n < MIDI_TX_EVENTS_PER_BANK && s_midi_tx_tail != s_midi_tx_head; n++) {
+			const uint8_t* event = (const uint8_t*)&s_midi_tx_queue[s_midi_tx_tail & (MIDI_TX_QUEUE_SIZE - 1)];
+			Endpoint_Write_8(event[0]);
+			Endpoint_Write_8(event[1]);
+			Endpoint_Write_8(event[2]);
+			Endpoint_Write_8(event[3]);
+			s_midi_tx_tail += 1;
+		}
+		Endpoint_ClearIN();
+		s_midi_tx_host_gone = false;
+	}
+}
+
+// Flush and keep flushing until the queue is empty, for replies such as
+// SysEx dumps that are bigger than the queue and must arrive intact. Gives
+// up after MIDI_TX_FLUSH_TIMEOUT_MS so a host that isn't listening can only
+// ever cost a bounded stall.
+//
+void midi_flush_wait(void)
+{
+	uint32_t start_time_ms = system_time_ms;
+	midi_flush();
+	while (s_midi_tx_tail != s_midi_tx_head &&
+	       (system_time_ms - start_time_ms) < MIDI_TX_FLUSH_TIMEOUT_MS) {
+		midi_flush();
+	}
+}
+#else
+// Send everything queued so far to the host now, rather than waiting for the
+// endpoint bank to fill up.
+//
+void midi_flush(void)
+{
+	#if ENABLE_MIDI_TX_BATCHING > 0
+	midi_tx_commit();
+	#endif
+	MIDI_Device_Flush(g_midi_interface_info); // MIDI_Device_USBTask calls Flush, but has redundant checks involved
+}
+
+void midi_flush_wait(void)
+{
+	midi_flush(); // already blocks until the host has taken the data
+}
+#endif
+
 void midi_stream_raw_note(const uint8_t channel,
                           const uint8_t pitch,
                           const bool onoff,
@@ -146,7 +460,7 @@ void midi_stream_raw_note(const uint8_t channel,
     midi_event.Data1       = command | (midi_channel & 0x0f);  // 0..15
     midi_event.Data2       = pitch & 0x7f;   // 0..127
     midi_event.Data3       = velocity & 0x7f; // 0..127
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 
@@ -172,7 +486,7 @@ void midi_stream_note_ch(const uint8_t channel,
     midi_event.Data2       = pitch & 0x7f;   // 0..127
     midi_event.Data3       = G_EE_MIDI_VELOCITY & 0x7f; // 0..127
 
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 void midi_stream_raw_cc(const uint8_t channel,
@@ -190,7 +504,7 @@ void midi_stream_raw_cc(const uint8_t channel,
     midi_event.Data1       = command | (channel & 0x0f); // 0..15
     midi_event.Data2       = cc & 0x7f;   // 0..127
     midi_event.Data3       = value & 0x7f;  // 0..127
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 
@@ -223,7 +537,7 @@ void midi_stream_note(const uint8_t pitch, const bool onoff)
     midi_event.Data2       = pitch & 0x7f;   // 0..127
     midi_event.Data3       = G_EE_MIDI_VELOCITY & 0x7f; // 0..127
 
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 // Append a Control Change Event to the currently selected USB Endpoint. If
@@ -248,7 +562,7 @@ void midi_stream_cc(const uint8_t controller, const uint8_t value)
     midi_event.Data2       = controller & 0x7f;   // 0..127
     midi_event.Data3       = value & 0x7f;  // 0..127
 
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 // Append a SysEx Event to the currently selected USB Endpoint. If
@@ -291,7 +605,7 @@ void midi_stream_sysex (const uint8_t length, uint8_t* data)
         }
         midi_event.Data2       = *data++;
         midi_event.Data3       = *data++;
-        MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+        midi_send_event(&midi_event);
         num -= 3;
     }
     if (num) {
@@ -331,11 +645,105 @@ void midi_stream_sysex (const uint8_t length, uint8_t* data)
             midi_event.Data2    = *data++;
             midi_event.Data3    = *data++;
         }
-        MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+        midi_send_event(&midi_event);
     }
 }
 
 
+#if USB_RX_METHOD == USB_RX_INTERRUPT
+// The USB endpoint Interrupt Service Routine (ISR).
+//
+// Fires when the host has completed a transfer into the OUT endpoint. The
+// whole bank is copied into the receive ring and handed back to the
+// controller straight away so the host can send the next one while the main
+// loop is busy scanning keys or pushing LEDs. With a double-banked endpoint
+// the other bank may already be full by the time we release this one, so
+// keep going until the controller has nothing left for us. If the ring can't
+// take a whole bank, the bank is left in the endpoint (the host gets NAKed,
+// so nothing is lost) and the interrupt is masked until the main loop
+// catches up.
+//
+ISR(USB_COM_vect)
+{
+	uint8_t prev_endpoint = Endpoint_GetCurrentEndpoint();
+	Endpoint_SelectEndpoint(MIDI_STREAM_OUT_EPADDR);
+
+	while (Endpoint_IsOUTReceived()) {
+		uint8_t head = s_midi_rx_ring_head;
+		uint8_t used = head - s_midi_rx_ring_tail;
+		uint8_t num_events = Endpoint_BytesInEndpoint() / sizeof(MIDI_EventPacket_t);
+
+		if (num_events > (uint8_t)(USB_RX_RING_SIZE - used)) {
+			UEIENX &= ~(1 << RXOUTE);
+			s_midi_rx_ring_stalled = true;
+			g_midi_rx_ring_overflow_count += 1;
+			break;
+		}
+		else {
+			for (; num_events; num_events--) {
+				uint8_t* event = (uint8_t*)&s_midi_rx_ring[head & (USB_RX_RING_SIZE - 1)];
+				event[0] = Endpoint_Read_8();
+				event[1] = Endpoint_Read_8();
+				event[2] = Endpoint_Read_8();
+				event[3] = Endpoint_Read_8();
+				head++;
+			}
+			s_midi_rx_ring_head = head;
+			Endpoint_ClearOUT(); // release the bank, discarding any trailing fragment
+
+			used = head - s_midi_rx_ring_tail;
+			if (used > g_midi_rx_ring_peak) {
+				g_midi_rx_ring_peak = used;
+			}
+		}
+	}
+
+	Endpoint_SelectEndpoint(prev_endpoint);
+}
+
+// Empty the receive ring and enable the OUT endpoint interrupt. Must be
+// called after the endpoints have been (re)configured.
+//
+void midi_rx_ring_enable(void)
+{
+	cli();
+	s_midi_rx_ring_head = 0;
+	s_midi_rx_ring_tail = 0;
+	s_midi_rx_ring_stalled = false;
+
+	uint8_t prev_endpoint = Endpoint_GetCurrentEndpoint();
+	Endpoint_SelectEndpoint(MIDI_STREAM_OUT_EPADDR);
+	UEIENX |= (1 << RXOUTE);
+	Endpoint_SelectEndpoint(prev_endpoint);
+	sei();
+}
+
+// Pop the oldest received event off the ring. Returns false if the ring is
+// empty, in which case a stalled OUT endpoint is also re-armed.
+//
+bool midi_rx_ring_read(MIDI_EventPacket_t* event)
+{
+	uint8_t tail = s_midi_rx_ring_tail;
+
+	if (tail == s_midi_rx_ring_head) {
+		if (s_midi_rx_ring_stalled) {
+			cli();
+			s_midi_rx_ring_stalled = false;
+			uint8_t prev_endpoint = Endpoint_GetCurrentEndpoint();
+			Endpoint_SelectEndpoint(MIDI_STREAM_OUT_EPADDR);
+			UEIENX |= (1 << RXOUTE);
+			Endpoint_SelectEndpoint(prev_endpoint);
+			sei();
+		}
+		return false;
+	}
+
+	*event = s_midi_rx_ring[tail & (USB_RX_RING_SIZE - 1)];
+	s_midi_rx_ring_tail = tail + 1;
+	return true;
+}
+#endif // USB_RX_INTERRUPT
+
 uint8_t midi_64_key_to_note(const uint8_t keynum) 
 {
 	uint8_t note = MIDI_BASENOTE + keynum;
@@ -345,7 +753,23 @@ uint8_t midi_64_key_to_note(const uint8_t keynum)
 void midi_clock(void)
 {
 	// If not enabled enable MIDI Clock
-	if(!midi_clock_enabled){display_flash_counter=0;midi_clock_enable(true);}
+	if(!midi_clock_enabled){
+		// The beat counter restarts at the first clock. Anything timed
+		// against it moves with it, or it would jump by the old count.
+		uint8_t sreg = SREG;
+		cli(); // the LED timer ISR counts beats until the clock is enabled
+		uint16_t restart = display_flash_counter;
+		display_flash_counter=0;
+		midi_clock_enable(true);
+		SREG = sreg;
+		#if ENABLE_PAD_FADES > 0
+		fastrgb_fades_rebase(restart);
+		#endif
+		#if ENABLE_SEQUENCES > 0
+		sequence_rebase(restart);
+		#endif
+		(void)restart; // in case nothing is timed against the beat counter
+	}
 	if(ticks == 3)
 	{
 		ticks = 1;
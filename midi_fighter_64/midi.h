@@ -25,6 +25,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <avr/interrupt.h>
 #include <LUFA/Drivers/USB/USB.h>
 
 
@@ -55,6 +56,24 @@ extern bool g_midi_sysex_is_valid;
 	
 extern bool midi_clock_enabled;
 
+#if ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND > 0
+extern uint16_t g_midi_tx_event_count;
+#endif
+
+#if ENABLE_MIDI_TX_NONBLOCKING > 0
+extern uint16_t g_midi_tx_merge_count;
+extern uint16_t g_midi_tx_drop_count;
+#endif
+
+#if ENABLE_TEST_OUT_USB_TX_MERGE > 0 && ENABLE_MIDI_TX_NONBLOCKING > 0
+extern uint8_t g_midi_tx_merge_test_failures; // one bit per failed case, 0 if the power-on check passed
+#endif
+
+#if USB_RX_METHOD == USB_RX_INTERRUPT
+extern volatile uint16_t g_midi_rx_ring_overflow_count; // banks held back because the ring was full
+extern volatile uint8_t g_midi_rx_ring_peak;            // most events ever waiting in the ring
+#endif
+
 // MIDI function prototypes ----------------------------------------------------
 
 void midi_setup(void);
@@ -62,6 +81,7 @@ void midi_stream_note_ch(const uint8_t channel, const uint8_t note, const bool o
 void midi_stream_note(const uint8_t note, const bool onoff);
 void midi_stream_cc(const uint8_t cc, const uint8_t value);
 void midi_flush(void);
+void midi_flush_wait(void);
 uint8_t midi_64_key_to_note(const uint8_t keynum);
 
 
@@ -81,4 +101,20 @@ void midi_clock(void);
 
 void midi_clock_enable(bool state);
 
+#if ENABLE_TEST_OUT_USB_TX_MERGE > 0 && ENABLE_MIDI_TX_NONBLOCKING > 0
+// Transmit queue check, see midi_test.c ------------------------------------------
+void midi_tx_merge_test(void);
+void midi_tx_test_send(const MIDI_EventPacket_t* event);
+void midi_tx_test_clear(void);
+uint8_t midi_tx_test_count(void);
+const MIDI_EventPacket_t* midi_tx_test_newest(uint8_t n);
+#endif
+
+#if USB_RX_METHOD == USB_RX_INTERRUPT
+// Interrupt driven receive ------------------------------------------------------
+ISR(USB_COM_vect);
+void midi_rx_ring_enable(void);
+bool midi_rx_ring_read(MIDI_EventPacket_t* event);
+#endif
+
 #endif // _MIDI_H_INCLUDED
@@ -0,0 +1,113 @@
+ /* midi_test.c
+ * DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+// Power-on check of the MIDI transmit queue (ENABLE_TEST_OUT_USB_TX_MERGE).
+// Test code only, none of it is built unless that flag is on. It runs the
+// orders that matter through a full queue before USB is up and reports one
+// bit per failed case on CC 21.
+
+#include "constants.h"
+#include "midi.h"
+
+#if ENABLE_TEST_OUT_USB_TX_MERGE > 0 && ENABLE_MIDI_TX_NONBLOCKING > 0
+uint8_t g_midi_tx_merge_test_failures = 0;
+
+static void midi_tx_merge_test_send(uint8_t command, uint8_t value)
+{
+    MIDI_EventPacket_t midi_event;
+
+	#if USE_LUFA_2015 > 0
+      midi_event.Event = command >> 4;
+	#else
+      midi_event.CableNumber = 0x0;
+      midi_event.Command     = command >> 4;
+	#endif
+    midi_event.Data1       = command;  // channel 0
+    midi_event.Data2       = 60;
+    midi_event.Data3       = value;
+    midi_tx_test_send(&midi_event);
+}
+
+// Fill the queue with pitch bends on the channel and number of the events
+// under test (they must never be merged with), leaving room for count more.
+static void midi_tx_merge_test_fill(uint8_t count)
+{
+	midi_tx_test_clear();
+	while (midi_tx_test_count() < MIDI_TX_QUEUE_SIZE - count) {
+		midi_tx_merge_test_send(0xE0, 0);
+	}
+}
+
+// Set a bit in g_midi_tx_merge_test_failures for each case that comes out
+// wrong.
+void midi_tx_merge_test(void)
+{
+	// On, Off, On, Off: the last NoteOn is cancelled, the host still gets
+	// the first On and Off and the note ends up off.
+	midi_tx_merge_test_fill(3);
+	midi_tx_merge_test_send(0x90, 100);
+	midi_tx_merge_test_send(0x80, 0);
+	midi_tx_merge_test_send(0x90, 100);
+	midi_tx_merge_test_send(0x80, 0);
+	if (midi_tx_test_count() != MIDI_TX_QUEUE_SIZE - 1 ||
+	    midi_tx_test_newest(0)->Data1 != 0x80 ||
+	    midi_tx_test_newest(1)->Data1 != 0x90) {
+		g_midi_tx_merge_test_failures |= 0x01;
+	}
+
+	// On, Off, Off: the newest is already a NoteOff, nothing is cancelled.
+	midi_tx_merge_test_fill(2);
+	midi_tx_merge_test_send(0x90, 100);
+	midi_tx_merge_test_send(0x80, 0);
+	midi_tx_merge_test_send(0x90, 0);
+	if (midi_tx_test_newest(0)->Data1 != 0x90 ||
+	    midi_tx_test_newest(1)->Data1 != 0x80 ||
+	    midi_tx_test_newest(2)->Data1 != 0x90) {
+		g_midi_tx_merge_test_failures |= 0x02;
+	}
+
+	// CC 1, 2, 3 then 4: only the newest queued value is replaced, so the
+	// host ends on 4.
+	midi_tx_merge_test_fill(3);
+	for (uint8_t value = 1; value <= 4; value++) {
+		midi_tx_merge_test_send(0xB0, value);
+	}
+	if (midi_tx_test_newest(0)->Data3 != 4 ||
+	    midi_tx_test_newest(1)->Data3 != 2 ||
+	    midi_tx_test_newest(2)->Data3 != 1) {
+		g_midi_tx_merge_test_failures |= 0x04;
+	}
+
+	// SysEx, then one pitch bend to fill the queue, then a NoteOn: the
+	// pitch bend makes room although the SysEx is older, and every SysEx
+	// packet stays queued, in order.
+	midi_tx_merge_test_fill(MIDI_TX_QUEUE_SIZE);
+	for (uint8_t value = 1; value < MIDI_TX_QUEUE_SIZE; value++) {
+		midi_tx_merge_test_send(0x40, value); // CIN 0x4, SysEx starts or continues
+	}
+	midi_tx_merge_test_send(0xE0, 0);
+	midi_tx_merge_test_send(0x90, 100);
+	if (midi_tx_test_count() != MIDI_TX_QUEUE_SIZE ||
+	    midi_tx_test_newest(0)->Data1 != 0x90 ||
+	    midi_tx_test_newest(1)->Data3 != MIDI_TX_QUEUE_SIZE - 1 ||
+	    midi_tx_test_newest(MIDI_TX_QUEUE_SIZE - 1)->Data3 != 1) {
+		g_midi_tx_merge_test_failures |= 0x08;
+	}
+
+	midi_tx_test_clear();
+}
+#endif
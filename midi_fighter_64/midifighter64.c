@@ -78,9 +78,14 @@ void EVENT_USB_Device_Connect(void);
 void EVENT_USB_Device_Disconnect(void);
 void EVENT_USB_Device_ConfigurationChanged(void);
 void EVENT_USB_Device_UnhandledControlRequest(void);
+void EVENT_USB_Device_StartOfFrame(void);
 
 static bool watchdog_flag = false;
 
+#if ENABLE_USB_SOF_SCHEDULER > 0
+static volatile bool usb_sof_pending = false; // a USB frame has started since the last main loop
+#endif
+
 #if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
 #warning Note On and Note Off Counter Output has been enabled
 uint16_t note_on_count = 0; // Note On messages Received that apply to bank 1
@@ -93,6 +98,10 @@ uint16_t note_off_delay_skip_count =  0; // Number of times a Note off has been
 uint16_t usb_packets_per_interval_max = 0;
 #endif
 
+#if ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND > 0
+uint16_t usb_rx_event_count = 0; // events received from the host since the last report
+#endif
+
 // USB Tasks and Events --------------------------------------------------------
 
 // We are in the process of enumerating but not yet ready to generate MIDI.
@@ -122,6 +131,16 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 		return;
     }
 
+	#if USB_RX_METHOD == USB_RX_INTERRUPT
+	// Start catching OUT banks in the background.
+	midi_rx_ring_enable();
+	#endif
+
+	#if ENABLE_USB_SOF_SCHEDULER > 0
+	// Pace the main loop from the 1ms USB Start-of-Frame.
+	USB_Device_EnableSOFEvents();
+	#endif
+
     // Success. Enable the display and do the power on light show
 	led_enable();
 	// power_on_lightshow();
@@ -129,6 +148,18 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 	wdt_enable(WDTO_2S);
 }
 
+#if ENABLE_USB_SOF_SCHEDULER > 0
+// A new 1ms USB frame has started. Called from the USB general interrupt, so
+// just flag it for the main loop. If the main loop is still busy (an LED
+// push with interrupts off can span several frames) the flag simply stays
+// set and the next pass starts as soon as the current one ends.
+//
+void EVENT_USB_Device_StartOfFrame(void)
+{
+	usb_sof_pending = true;
+}
+#endif
+
 // Any other USB control command that we don't recognize is handled here.
 //
 void EVENT_USB_Device_UnhandledControlRequest(void)
@@ -203,46 +234,13 @@ void update_note_off_feedback_delay(void) {
     }
 }
 
-// DISABLE_LUFA_2015_LARGE_PACKET_UPGRADE
-void Midifighter_GetIncomingUsbMidiMessages(void) {
-    // If there is data in the Endpoint for us to read, get a USB-MIDI
-    // packet to process. Endpoint_IsReadWriteAllowed() returns true if
-    // there is data remaining inside an OUT endpoint or if an IN endpoint
-    // has space left to fill. The same function doing two jobs, confusing
-    // but there you are.
-
-    MIDI_EventPacket_t input_event;
-	uint16_t usb_rx_fail_count = 0;
-	uint16_t usb_rx_packets = 0;
-		
-	while (1) {
-		//break; // !test: no LED Feedback reading
-		//#if USB_RX_METHOD < USB_RX_PERIODICALLY
-		// Wait here and actively detect incoming USB Messages continuously for up to 1ms
-		if (usb_rx_packets >= USB_RX_PACKET_LIMIT) {
-			break;
-		}
-	    else if (!MIDI_Device_ReceiveEventPacket(g_midi_interface_info,
-	    &input_event)) {  // 
-			usb_rx_fail_count += 1;
-			if (usb_rx_fail_count >= USB_RX_FAIL_LIMIT) {
-				break;
-			} else {  // 200us on Mac, up to 400us on windows
-				wdt_reset();
-				continue;
-			}
-			// - we add this delay so that we may get a full frame of leds (often 4 or 5 usb packets) at once.
-		} else {
-			//Endpoint_ClearOUT(); // !Windows Test: Clear Endpoing Manually (no effect)
-			usb_rx_packets += 1;
-			usb_rx_fail_count = 0;
-			
-			#if ENABLE_TEST_OUT_USB_PACKETS_PER_INTERVAL > 0
-			if (usb_rx_packets > usb_packets_per_interval_max) {
-				usb_packets_per_interval_max = usb_rx_packets;
-			}
-			#endif
-		}
+// Parse a single USB-MIDI event packet received from the host and apply it
+// to the keystate / LED state.
+//
+static void Midifighter_HandleUsbMidiEvent(MIDI_EventPacket_t* input_event) {
+		#if ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND > 0
+		usb_rx_event_count += 1;
+		#endif
 
         // Assuming all virtual MIDI cables are intended for us, ensure that
         // this event is being sent on our current MIDI channel.
@@ -272,15 +270,15 @@ void Midifighter_GetIncomingUsbMidiMessages(void) {
         // Parse the USB-MIDI packet to see what it contains
 		#if USE_LUFA_2015 > 0
 		 #warning USING LUFA USB 2015
-		 uint8_t command = input_event.Event & 0x0F;
+		 uint8_t command = input_event->Event & 0x0F;
 		 switch (command) {
 		#else 
-         switch (input_event.Command) {
+         switch (input_event->Command) {
 		#endif
 			case 0xF :
 			{
 				// This is a single byte Real Time message.
-				switch (input_event.Data1) {
+				switch (input_event->Data1) {
 					case 0xF8 :
 					// Midi Clock Event
 					midi_clock_enable(true);
@@ -303,10 +301,10 @@ void Midifighter_GetIncomingUsbMidiMessages(void) {
 			{
 				 // A NoteOn event was found, if the Channel is within the
 				// correct range update the stored velocity
-				uint8_t channel = input_event.Data1 & 0x0f;
+				uint8_t channel = input_event->Data1 & 0x0f;
 				if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-					uint8_t note = input_event.Data2;
-					uint8_t velocity = input_event.Data3;
+					uint8_t note = input_event->Data2;
+					uint8_t velocity = input_event->Data3;
 					uint8_t key_id = note - MIDI_BASENOTE;
 					if (key_id < NUM_BUTTONS) {
 						fastrgb_ableton_single(key_id, velocity);
@@ -318,6 +316,20 @@ void Midifighter_GetIncomingUsbMidiMessages(void) {
 						#endif
 					}
 				}
+				#if ENABLE_PAD_EFFECTS > 0
+				else {
+					// Flash / pulse on the channels after ours, velocity 0 stops the effect
+					uint8_t offset = (channel - G_EE_MIDI_CHANNEL) & 0x0f;
+					uint8_t key_id = input_event->Data2 - MIDI_BASENOTE;
+					if (key_id < NUM_BUTTONS) {
+						if (offset == PAD_EFFECT_FLASH_CHANNEL_OFFSET) {
+							fastrgb_effect_set(key_id, FASTRGB_EFFECT_FLASH, input_event->Data3);
+						} else if (offset == PAD_EFFECT_PULSE_CHANNEL_OFFSET) {
+							fastrgb_effect_set(key_id, FASTRGB_EFFECT_PULSE, input_event->Data3);
+						}
+					}
+				}
+				#endif
 			}
 			break;
 			case 0x8 :
@@ -327,10 +339,10 @@ void Midifighter_GetIncomingUsbMidiMessages(void) {
 				// but we're relying on the keystate to be zero when
 				// we have a noteoff, otherwise the LEDs won't match
 				// the state when we come to calculate them.
-				uint8_t channel = input_event.Data1 & 0x0f;
+				uint8_t channel = input_event->Data1 & 0x0f;
 				if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-					uint8_t note = input_event.Data2;
-					//uint8_t velocity = input_event.Data3;
+					uint8_t note = input_event->Data2;
+					//uint8_t velocity = input_event->Data3;
 					uint8_t key_id = note - MIDI_BASENOTE;
 					if (key_id < NUM_BUTTONS) {
 						#if ENABLE_NOTE_OFF_FEEDBACK_DELAY <= 0
@@ -345,39 +357,206 @@ void Midifighter_GetIncomingUsbMidiMessages(void) {
 						#endif
 					}
 				}		
+				#if ENABLE_PAD_EFFECTS > 0
+				else {
+					// A NoteOff on a flash / pulse channel stops the effect
+					uint8_t offset = (channel - G_EE_MIDI_CHANNEL) & 0x0f;
+					uint8_t key_id = input_event->Data2 - MIDI_BASENOTE;
+					if (key_id < NUM_BUTTONS && (offset == PAD_EFFECT_FLASH_CHANNEL_OFFSET ||
+					                             offset == PAD_EFFECT_PULSE_CHANNEL_OFFSET)) {
+						fastrgb_effect_set(key_id, FASTRGB_EFFECT_FLASH, 0);
+					}
+				}
+				#endif
 			}
 			break;
 			case 0x4 :
 				{
 					// 3 byte sysex start or continue
-					sysex_handle_3sc(&input_event);                
+					sysex_handle_3sc(input_event);                
 				}
 				break;
 			case 0x5 :
 				{
 					// One byte sysex end or system common
-					sysex_handle_1e(&input_event);
+					sysex_handle_1e(input_event);
 				}
 				break;
 			case 0x6 :
 				{
 					// 2 byte sysex end
-					sysex_handle_2e(&input_event);
+					sysex_handle_2e(input_event);
 				}
 				break;
 			case 0x7 :
 				{
 					// 3 byte sysex end
-					sysex_handle_3e(&input_event);
+					sysex_handle_3e(input_event);
 				}
 				break;
 			default:
 				// do nothing.
 				break;
 			} // end USB-MIDI packet parse
+}
+
+#if USB_RX_METHOD == USB_RX_INTERRUPT && ENABLE_LUFA_2015_LARGE_PACKET_UPGRADE > 0
+#error ENABLE_LUFA_2015_LARGE_PACKET_UPGRADE is a polled receive path, turn it off with USB_RX_INTERRUPT
+#endif
+
+#if USB_RX_METHOD == USB_RX_INTERRUPT
+// Interrupt receive: USB_COM_vect has already copied every OUT bank the
+// host sent into the receive ring, so there is nothing to wait for here.
+// Dispatch what has arrived (at most one ring's worth, so a host streaming
+// flat out can't starve key scanning) and get back to the main loop.
+void Midifighter_GetIncomingUsbMidiMessages(void) {
+    MIDI_EventPacket_t input_event;
+
+	for (uint8_t i = 0; i < USB_RX_RING_SIZE; i++) {
+		if (!midi_rx_ring_read(&input_event)) {
+			break;
+		}
+		Midifighter_HandleUsbMidiEvent(&input_event);
+	}
+}
+#elif ENABLE_LUFA_2015_LARGE_PACKET_UPGRADE > 0
+#if USE_LUFA_2015 <= 0
+#error ENABLE_LUFA_2015_LARGE_PACKET_UPGRADE requires USE_LUFA_2015
+#endif
+// Whole-bank receive: rather than pulling one 4-byte event at a time out of
+// the OUT endpoint (which re-checks the device state, reselects the endpoint
+// and starts a new stream read for every event), read everything the host
+// put in the bank with a single stream read and dispatch the events from RAM.
+// A full 64-byte bank is 16 events for the price of one driver call.
+void Midifighter_GetIncomingUsbMidiMessages(void) {
+    MIDI_EventPackets_t input_events;
+	uint16_t usb_rx_fail_count = 0;
+	uint16_t usb_rx_packets = 0;
+
+	while (1) {
+		// Wait here and actively detect incoming USB Messages continuously for up to 1ms
+		if (usb_rx_packets >= USB_RX_PACKET_LIMIT) {
+			break;
+		}
+
+		// Find out how much the host has left in the bank. Only whole
+		// events are read, a malformed trailing fragment stays in the bank
+		// and gets discarded with it.
+		uint8_t bank_bytes = 0;
+		Endpoint_SelectEndpoint(g_midi_interface_info->Config.DataOUTEndpoint.Address);
+		if (Endpoint_IsOUTReceived()) {
+			bank_bytes = Endpoint_BytesInEndpoint() & ~(sizeof(MIDI_EventPacket_t) - 1);
+			if (bank_bytes > sizeof(MIDI_EventPackets_t)) {
+				bank_bytes = sizeof(MIDI_EventPackets_t);
+			}
+		}
+
+		if (!bank_bytes ||
+		    !MIDI_Device_ReceiveLargeEventPacket(g_midi_interface_info, &input_events, bank_bytes)) {
+			if (bank_bytes == 0 && Endpoint_IsOUTReceived()) {
+				Endpoint_ClearOUT(); // zero length or fragment only, release the bank
+			}
+			usb_rx_fail_count += 1;
+			if (usb_rx_fail_count >= USB_RX_FAIL_LIMIT) {
+				break;
+			} else {  // 200us on Mac, up to 400us on windows
+				wdt_reset();
+				continue;
+			}
+		}
+
+		uint8_t num_events = bank_bytes / sizeof(MIDI_EventPacket_t);
+		usb_rx_packets += num_events;
+		usb_rx_fail_count = 0;
+
+		#if ENABLE_TEST_OUT_USB_PACKETS_PER_INTERVAL > 0
+		if (usb_rx_packets > usb_packets_per_interval_max) {
+			usb_packets_per_interval_max = usb_rx_packets;
+		}
+		#endif
+
+		for (uint8_t i = 0; i < num_events; i++) {
+			Midifighter_HandleUsbMidiEvent(&input_events.events[i]);
+		}
+	} // end while
+}
+#else
+void Midifighter_GetIncomingUsbMidiMessages(void) {
+    // If there is data in the Endpoint for us to read, get a USB-MIDI
+    // packet to process. Endpoint_IsReadWriteAllowed() returns true if
+    // there is data remaining inside an OUT endpoint or if an IN endpoint
+    // has space left to fill. The same function doing two jobs, confusing
+    // but there you are.
+
+    MIDI_EventPacket_t input_event;
+	uint16_t usb_rx_fail_count = 0;
+	uint16_t usb_rx_packets = 0;
+		
+	while (1) {
+		//break; // !test: no LED Feedback reading
+		//#if USB_RX_METHOD < USB_RX_PERIODICALLY
+		// Wait here and actively detect incoming USB Messages continuously for up to 1ms
+		if (usb_rx_packets >= USB_RX_PACKET_LIMIT) {
+			break;
+		}
+	    else if (!MIDI_Device_ReceiveEventPacket(g_midi_interface_info,
+	    &input_event)) {  // 
+			usb_rx_fail_count += 1;
+			if (usb_rx_fail_count >= USB_RX_FAIL_LIMIT) {
+				break;
+			} else {  // 200us on Mac, up to 400us on windows
+				wdt_reset();
+				continue;
+			}
+			// - we add this delay so that we may get a full frame of leds (often 4 or 5 usb packets) at once.
+		} else {
+			//Endpoint_ClearOUT(); // !Windows Test: Clear Endpoing Manually (no effect)
+			usb_rx_packets += 1;
+			usb_rx_fail_count = 0;
+			
+			#if ENABLE_TEST_OUT_USB_PACKETS_PER_INTERVAL > 0
+			if (usb_rx_packets > usb_packets_per_interval_max) {
+				usb_packets_per_interval_max = usb_rx_packets;
+			}
+			#endif
+		}
+
+		Midifighter_HandleUsbMidiEvent(&input_event);
     } // end while
 }
-//# DISABLE_LUFA_2015_LARGE_PACKET_UPGRADE
+#endif // USB_RX_METHOD
+
+// There's a key down, put a NoteOn and/or CC event into the stream.
+static void Midifighter_SendKeyDown(uint8_t key)
+{
+	uint8_t note = midi_64_key_to_note(key);
+
+	if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
+		midi_stream_note(note, true);
+	}
+
+	if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
+	{
+		midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,127);
+	}
+}
+
+// There's a key up, put a NoteOff and/or CC event onto the stream.
+static void Midifighter_SendKeyUp(uint8_t key)
+{
+	uint8_t note = midi_64_key_to_note(key);
+	// Adjust channel
+	uint8_t channel = G_EE_MIDI_CHANNEL;
+	// Output Note Message
+	if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
+		midi_stream_note_ch(channel, note, false);
+	}
+	// Output CC Message
+	if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
+	{
+		midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,0);
+	}
+}
 
 void Midifighter_Task(void)
 {
@@ -392,6 +571,91 @@ void Midifighter_Task(void)
 		//midi_stream_raw_cc(11, system_time_ms >> 7 & 0x7F, system_time_ms & 0x7F); // System Time Check
 	}
 	#endif
+
+	#if ENABLE_TEST_OUT_USB_RX_RING > 0 && USB_RX_METHOD == USB_RX_INTERRUPT
+	#warning TEST: USB RX Ring Counter Output is ENABLED!
+	static uint32_t last_sent_ring_time_ms = 0;
+	if (system_time_ms - last_sent_ring_time_ms >= 1000) {
+		last_sent_ring_time_ms = system_time_ms;
+		cli(); // 16-bit counter is updated by the ISR
+		uint16_t overflow_count = g_midi_rx_ring_overflow_count;
+		sei();
+		midi_stream_raw_cc(10, (overflow_count >> 7) & 0x7F, overflow_count & 0x7F);
+		midi_stream_raw_cc(11, 0, g_midi_rx_ring_peak & 0x7F);
+	}
+	#endif
+
+	#if ENABLE_TEST_OUT_USB_EVENTS_PER_SECOND > 0
+	#warning TEST: USB Events Per Second Output is ENABLED!
+	static uint32_t last_sent_rate_time_ms = 0;
+	if (system_time_ms - last_sent_rate_time_ms >= 1000) {
+		last_sent_rate_time_ms = system_time_ms;
+		uint16_t tx_event_count = g_midi_tx_event_count; // sampled before our own report adds to it
+		midi_stream_raw_cc(12, (usb_rx_event_count >> 7) & 0x7F, usb_rx_event_count & 0x7F);
+		midi_stream_raw_cc(13, (tx_event_count >> 7) & 0x7F, tx_event_count & 0x7F);
+		usb_rx_event_count = 0;
+		g_midi_tx_event_count = 0;
+	}
+	#endif
+
+	#if ENABLE_TEST_OUT_USB_TX_QUEUE > 0 && ENABLE_MIDI_TX_NONBLOCKING > 0
+	#warning TEST: USB TX Queue Counter Output is ENABLED!
+	static uint32_t last_sent_tx_queue_time_ms = 0;
+	if (system_time_ms - last_sent_tx_queue_time_ms >= 1000) {
+		last_sent_tx_queue_time_ms = system_time_ms;
+		midi_stream_raw_cc(16, (g_midi_tx_merge_count >> 7) & 0x7F, g_midi_tx_merge_count & 0x7F);
+		midi_stream_raw_cc(17, (g_midi_tx_drop_count >> 7) & 0x7F, g_midi_tx_drop_count & 0x7F);
+	}
+	#endif
+
+	#if ENABLE_TEST_OUT_USB_TX_MERGE > 0 && ENABLE_MIDI_TX_NONBLOCKING > 0
+	#warning TEST: USB TX Merge Check Output is ENABLED!
+	static uint32_t last_sent_tx_merge_time_ms = 0;
+	if (system_time_ms - last_sent_tx_merge_time_ms >= 1000) {
+		last_sent_tx_merge_time_ms = system_time_ms;
+		midi_stream_raw_cc(21, 0, g_midi_tx_merge_test_failures & 0x7F);
+	}
+	#endif
+
+	#if ENABLE_TEST_OUT_KEY_SCAN_TIME > 0
+	#warning TEST: Key Scan Time Output is ENABLED!
+	static uint32_t last_sent_key_scan_time_ms = 0;
+	if (system_time_ms - last_sent_key_scan_time_ms >= 1000) {
+		last_sent_key_scan_time_ms = system_time_ms;
+		midi_stream_raw_cc(18, (g_key_scan_ticks_peak >> 7) & 0x7F, g_key_scan_ticks_peak & 0x7F);
+	}
+	#endif
+
+	#if ENABLE_TEST_OUT_KEY_EVENT_QUEUE > 0 && ENABLE_KEY_EVENT_QUEUE > 0
+	#warning TEST: Key Event Queue Output is ENABLED!
+	static uint16_t key_event_wait_peak_ms = 0;
+	static uint32_t last_sent_key_event_time_ms = 0;
+	if (system_time_ms - last_sent_key_event_time_ms >= 1000) {
+		last_sent_key_event_time_ms = system_time_ms;
+		cli();
+		uint16_t overflow_count = g_key_event_overflow_count;
+		sei();
+		midi_stream_raw_cc(19, (overflow_count >> 7) & 0x7F, overflow_count & 0x7F);
+		midi_stream_raw_cc(20, (key_event_wait_peak_ms >> 7) & 0x7F, key_event_wait_peak_ms & 0x7F);
+	}
+	#endif
+
+	#if ENABLE_TEST_OUT_USB_FRAME_SCHEDULE > 0
+	#warning TEST: USB Frame Schedule Output is ENABLED!
+	static uint16_t frame_loop_count = 0;
+	static uint16_t frame_elapsed_count = 0;
+	static uint16_t last_frame_number = 0;
+	uint16_t frame_number = USB_Device_GetFrameNumber();
+	frame_elapsed_count += (frame_number - last_frame_number) & 0x07FF; // 11-bit frame counter
+	last_frame_number = frame_number;
+	frame_loop_count += 1;
+	if (frame_elapsed_count >= 1000) {
+		midi_stream_raw_cc(14, (frame_loop_count >> 7) & 0x7F, frame_loop_count & 0x7F);
+		midi_stream_raw_cc(15, (frame_elapsed_count >> 7) & 0x7F, frame_elapsed_count & 0x7F);
+		frame_loop_count = 0;
+		frame_elapsed_count = 0;
+	}
+	#endif
 	
     // If the Midifighter is not completely enumerated by the USB Host,
     // don't go any further - no updating of LEDs, no reading from
@@ -399,6 +663,9 @@ void Midifighter_Task(void)
 	#if ENABLE_RGB_TEST <= 0
 	if (USB_DeviceState != DEVICE_STATE_Configured) { // don't go any further if we don't have a USB Connection
 		// !review: add LED Feedback for this state?
+		#if ENABLE_KEY_EVENT_QUEUE > 0
+		key_event_flush(); // nobody to send them to, and stale once the host configures us
+		#endif
         return;
     }
 	#endif
@@ -409,8 +676,12 @@ void Midifighter_Task(void)
     // the outside world first, from the keyboard second, 
     // and generate the LED display from the resulting table at the end.
 
+    // With ENABLE_USB_SOF_SCHEDULER each pass starts on a USB frame and runs
+    // three fixed slots in order: receive drain, key events send (ending in
+    // one flush), then the LED push.
+
     // INPUT MIDI from USB -----------------------------------------------------
-	#if USB_RX_METHOD < USB_RX_PERIODICALLY
+	#if USB_RX_METHOD != USB_RX_PERIODICALLY
 	Midifighter_GetIncomingUsbMidiMessages();
     #endif
 
@@ -421,51 +692,66 @@ void Midifighter_Task(void)
 	// key_send();
     // - Loop over all of the 16 arcade keys and send MIDI messages, converting key numbers
     // - to MIDI notes using the mapping table.
+	#if ENABLE_KEY_EVENT_QUEUE > 0
+	// - Take the transitions in the order the ISR saw them, so taps shorter
+	// -- than a stalled loop aren't lost. Anything past KEY_EVENTS_PER_LOOP
+	// --- waits in the queue for the next pass.
+	{
+		key_event_t key_event;
+		for (uint8_t n=0; n<KEY_EVENTS_PER_LOOP && key_event_read(&key_event); ++n) {
+			#if USB_RX_METHOD == USB_RX_PERIODICALLY
+			Midifighter_GetIncomingUsbMidiMessages();
+			#endif
+			uint8_t key = key_event.key & ~KEY_EVENT_PRESSED;
+			if (key_event.key & KEY_EVENT_PRESSED) {
+				g_key_down_rows |= (1 << (key >> 3)); // the sleep timer needs to see taps too
+				Midifighter_SendKeyDown(key);
+			} else {
+				Midifighter_SendKeyUp(key);
+			}
+			#if ENABLE_TEST_OUT_KEY_EVENT_QUEUE > 0 && ENABLE_KEY_EVENT_QUEUE > 0
+			uint16_t waited_ms = (uint16_t)system_time_ms - key_event.time_ms;
+			if (waited_ms > key_event_wait_peak_ms) {
+				key_event_wait_peak_ms = waited_ms;
+			}
+			#endif
+		}
+		// update sleep timer (if necessary)
+		if (g_key_down_rows) {
+			sleep_minute_counter=0;
+		}
+	}
+	#else
     {
-        uint64_t key_bit = 0x0001;
 		// update sleep timer (if necessary)
-		if (g_key_down) {
+		if (g_key_down_rows) {
 			sleep_minute_counter=0;
 		}
-		// Service Each Individual Button
-        for(uint8_t i=0; i<64; ++i) {
-			#if USB_RX_METHOD >= USB_RX_PERIODICALLY
+		// Service Each Individual Button, skipping rows where nothing moved
+        for(uint8_t row=0; row<KEY_ROWS; ++row) {
+			#if USB_RX_METHOD == USB_RX_PERIODICALLY
 			Midifighter_GetIncomingUsbMidiMessages();
 			#endif
-            if (g_key_down & key_bit) {
-                // There's a key down, put a NoteOn and/or CC event into the stream.
-                uint8_t note = midi_64_key_to_note(i);
-
-				if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
-				    midi_stream_note(note, true);
-                }
-
-                if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
-                {
-				    midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,127);
-                }
-            }
-            if (g_key_up & key_bit) {
-                // There's a key up, put a NoteOff event onto the stream.
-                uint8_t note = midi_64_key_to_note(i);
-				// Adjust channel
-				uint8_t channel = G_EE_MIDI_CHANNEL;
-				// Output Note Message
-				if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
-				    midi_stream_note_ch(channel, note, false);
-			    }
-				// Output CC Message
-                if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
-                {
-					midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,0);
+			uint8_t down = g_key_down[row];
+			uint8_t up = g_key_up[row];
+			if (!(down | up)) {
+				continue;
+			}
+			uint8_t key_bit = 0x01;
+			for (uint8_t i=row*8; key_bit; ++i, key_bit <<= 1) {
+				if (down & key_bit) {
+					Midifighter_SendKeyDown(i);
+				}
+				if (up & key_bit) {
+					Midifighter_SendKeyUp(i);
 				}
-            }
-            key_bit <<= 1;
+			}
         }
     }
+	#endif
 	
     // Finished generating MIDI events, flush the endpoints. (otherwise it won't send until it's full!)
-	MIDI_Device_Flush(g_midi_interface_info); // MIDI_Device_USBTask calls Flush, but has redundant checks involved
+	midi_flush(); // commits the queued events to free IN banks, never waits for the host
 
 	// Finally update the display with current frame
 	last_led_refresh_time_ms = system_time_ms;
@@ -478,7 +764,7 @@ void Midifighter_Task(void)
 	default_display_run();
 
 	// Send Data to the LEDs
-	led_update_pixels(g_display_buffer);
+	display_push();
 	
 	watchdog_flag = true;
 }
@@ -506,6 +792,7 @@ int main(void)
 	// USB_PLL_On(); // Works when you disable 'AUTO_PLL' in makefile
 	// while (!(USB_PLL_IsReady()));
 	// - but device still hangs on MIDI_Device_flush (waiting 100ms as is defined in lufa by a timeout)
+	// - ENABLE_MIDI_TX_NONBLOCKING: midi_flush() no longer waits for the host, events queue instead
 
 	// Start up the subsystems.
     eeprom_setup();   // setup global settings from the EEPROM
@@ -526,7 +813,7 @@ int main(void)
     // the USB scheduler starts because shutting down these subsystems
     // before entering the bootloader is a little involved.
     //if ((g_key_state == 0xC09009)) {
-    if ((g_key_state & 0x01)) {
+    if ((g_key_state[0] & 0x01)) {
         // Drop to Bootloader:
         //  # . . #
         //  . . . .
@@ -561,7 +848,16 @@ int main(void)
     for(;;) {
         // Read keys and motion tracking for User and MIDI events to process,
         // setting LEDs to display the resulting state.
+		#if ENABLE_USB_SOF_SCHEDULER > 0
+		// Only start a new pass once the next USB frame has begun. Until we
+		// are configured there are no frames to wait for.
+		if (usb_sof_pending || USB_DeviceState != DEVICE_STATE_Configured) {
+			usb_sof_pending = false;
+			Midifighter_Task();
+		}
+		#else
 		Midifighter_Task();
+		#endif
 				
         // Let the LUFA MIDI Device drivers have a go.
 		// MIDI_Device_USBTask(g_midi_interface_info);
@@ -0,0 +1,272 @@
+ /* sequence.c
+ * DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "sequence.h"
+#include "fastrgb.h"
+#include "key.h" // for system_time_ms
+#include "led.h" // for display_flash_counter
+#include "midi.h" // for midi_stream_sysex()
+
+#if ENABLE_SEQUENCES > 0
+
+/*
+Animation sequences and scenes stored on the device, lighting SysEx 0x1F. The
+first data byte is a command:
+
+F0 1F 00 F7               clear the store and stop playback
+F0 1F 01 <frame> F7       append one frame in the 0x5F compressed format
+F0 1F 02 <mode> <fps> [<first> <count>] F7
+                          play, mode 1 = one-shot, 2 = loop. fps 0 draws one
+                          frame per display_flash_counter step (1/8 beat, so
+                          it follows MIDI clock when there is one). Optionally
+                          only count frames from frame first (count 0 = all)
+F0 1F 03 F7               stop
+F0 1F 04 <frame> F7       recall: stop and draw one stored frame
+F0 1F 05 [<slot>] F7      snapshot: store the current pads as frame slot,
+                          replacing what was there, or append them without a
+                          slot. Replies F0 1F 05 <slot> <status> F7, status
+                          SEQUENCE_SNAPSHOT_OK or SEQUENCE_SNAPSHOT_FULL
+
+A scene is just a stored frame, so scenes and animations share the store and
+a recall is a single frame drawn between two display_push() calls, never a
+partly drawn one. Snapshotting past the last frame fills the gap with empty
+frames, which draw nothing. A snapshot's size is worked out before anything
+moves, so one that doesn't fit leaves the store as it was.
+
+Frames are kept back to back in RAM, each behind its length byte. A frame
+that does not fit is dropped, the ones before it are kept.
+
+Scenes are deliberately limited to what this store can do:
+- There are no fixed scene slots and no room is set aside for them. Scenes
+  and animation frames share the SEQUENCE_STORE_BYTES store, so a long
+  animation can leave no room for a snapshot, and a slot number is only a
+  frame index, which moves when an earlier frame changes size.
+- A frame has a one byte length, so a grid whose 0x5F encoding is over 255
+  bytes (a busy, many colored grid) can't be stored and its snapshot replies
+  SEQUENCE_SNAPSHOT_FULL however empty the store is.
+- Nothing is kept at power off. The free EEPROM went to the user velocity
+  palette (see EE_USER_PALETTE_RG), so scenes have to be sent again by the
+  host after a restart.
+*/
+
+#define SEQUENCE_CMD_CLEAR   0
+#define SEQUENCE_CMD_APPEND  1
+#define SEQUENCE_CMD_PLAY    2
+#define SEQUENCE_CMD_STOP    3
+#define SEQUENCE_CMD_RECALL  4
+#define SEQUENCE_CMD_SNAPSHOT 5
+#define SEQUENCE_CMD_NONE    0xFF
+
+static uint8_t sequence_store[SEQUENCE_STORE_BYTES];
+static uint16_t sequence_length;    // bytes holding complete frames
+static uint16_t sequence_write;     // end of the frame being uploaded
+static bool sequence_overflow;      // the frame being uploaded does not fit
+
+static uint8_t sequence_command = SEQUENCE_CMD_NONE;
+static uint8_t sequence_args[4];
+static uint8_t sequence_arg_count;
+
+static uint8_t sequence_mode = SEQUENCE_STOPPED;
+static uint8_t sequence_fps;
+static uint16_t sequence_interval;  // ms, or display_flash_counter steps when fps is 0
+static uint16_t sequence_last;      // when the last frame was due
+static uint16_t sequence_pos;       // offset of the next frame to draw
+static uint16_t sequence_first;     // offset of the first frame played
+static uint16_t sequence_end;       // offset after the last frame played, 0xFFFF for all
+
+// Both clocks are written by interrupts; read them in one piece.
+static uint16_t sequence_now(void) {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t now = sequence_fps? (uint16_t)system_time_ms : display_flash_counter;
+	SREG = sreg;
+	return now;
+}
+
+static uint8_t sequence_frame_count(void) {
+	uint8_t n = 0;
+	for (uint16_t pos = 0; pos < sequence_length && n < 0xFF; pos += sequence_store[pos] + 1) n++;
+	return n;
+}
+
+// Byte offset of frame n, or sequence_length when there are fewer frames.
+static uint16_t sequence_frame_offset(uint8_t n) {
+	uint16_t pos = 0;
+	while (n-- && pos < sequence_length) pos += sequence_store[pos] + 1;
+	return pos < sequence_length? pos : sequence_length;
+}
+
+static void sequence_draw(uint16_t pos) {
+	uint8_t len = sequence_store[pos];
+	const uint8_t* frame = &sequence_store[pos + 1];
+	fastrgb_decompress(frame, frame + len);
+}
+
+static void sequence_reverse(uint16_t from, uint16_t to) {
+	while (from + 1 < to) {
+		uint8_t t = sequence_store[from];
+		sequence_store[from++] = sequence_store[--to];
+		sequence_store[to] = t;
+	}
+}
+
+// Store the current pads as frame slot, see SEQUENCE_CMD_SNAPSHOT.
+static uint8_t sequence_snapshot(uint8_t slot) {
+	uint8_t frames = sequence_frame_count();
+	uint8_t gap = slot > frames? slot - frames : 0;
+	uint16_t pos = slot < frames? sequence_frame_offset(slot) : sequence_length + gap;
+	uint8_t old = slot < frames? sequence_store[pos] + 1 : 0;
+	uint8_t len = fastrgb_compress(NULL, 255);
+
+	if (len == 0 || sequence_length - old + gap + len + 1 > SEQUENCE_STORE_BYTES) {
+		return SEQUENCE_SNAPSHOT_FULL;
+	}
+
+	if (old) {
+		sequence_stop(); // the frames move under playback
+		memmove(&sequence_store[pos], &sequence_store[pos + old], sequence_length - pos - old);
+		sequence_length -= old;
+	} else {
+		memset(&sequence_store[sequence_length], 0, gap); // empty frames
+		sequence_length += gap;
+	}
+
+	// Encode at the end, then rotate it into place in front of the frames after it.
+	sequence_store[sequence_length] = len;
+	fastrgb_compress(&sequence_store[sequence_length + 1], len);
+	sequence_reverse(pos, sequence_length);
+	sequence_reverse(sequence_length, sequence_length + len + 1);
+	sequence_reverse(pos, sequence_length + len + 1);
+	sequence_length += len + 1;
+	return SEQUENCE_SNAPSHOT_OK;
+}
+
+void sequence_sysex_begin(void) {
+	sequence_command = SEQUENCE_CMD_NONE;
+	sequence_arg_count = 0;
+}
+
+void sequence_sysex_byte(uint8_t v) {
+	if (sequence_command == SEQUENCE_CMD_NONE) {
+		sequence_command = v;
+		if (v == SEQUENCE_CMD_APPEND) {
+			sequence_write = sequence_length + 1; // after the length byte
+			sequence_overflow = sequence_write > SEQUENCE_STORE_BYTES;
+		}
+	} else if (sequence_command == SEQUENCE_CMD_APPEND) {
+		// Playback only reads up to sequence_length, so this is safe while playing.
+		if (sequence_write < SEQUENCE_STORE_BYTES && sequence_write - sequence_length <= 255) {
+			sequence_store[sequence_write++] = v;
+		} else {
+			sequence_overflow = true;
+		}
+	} else if (sequence_arg_count < sizeof(sequence_args)) {
+		sequence_args[sequence_arg_count++] = v;
+	}
+}
+
+void sequence_sysex_end(void) {
+	switch (sequence_command) {
+	case SEQUENCE_CMD_CLEAR:
+		sequence_stop();
+		sequence_length = 0;
+		break;
+	case SEQUENCE_CMD_APPEND:
+		if (!sequence_overflow) {
+			sequence_store[sequence_length] = sequence_write - sequence_length - 1;
+			sequence_length = sequence_write;
+		}
+		break;
+	case SEQUENCE_CMD_PLAY:
+		if (sequence_arg_count >= 2) {
+			sequence_play(sequence_args[0], sequence_args[1]);
+			if (sequence_arg_count == 4) {
+				sequence_first = sequence_pos = sequence_frame_offset(sequence_args[2]);
+				if (sequence_args[3]) sequence_end = sequence_frame_offset(sequence_args[2] + sequence_args[3]);
+			}
+		}
+		break;
+	case SEQUENCE_CMD_STOP:
+		sequence_stop();
+		break;
+	case SEQUENCE_CMD_RECALL:
+		if (sequence_arg_count == 1) {
+			uint16_t pos = sequence_frame_offset(sequence_args[0]);
+			sequence_stop();
+			if (pos < sequence_length) sequence_draw(pos);
+		}
+		break;
+	case SEQUENCE_CMD_SNAPSHOT: {
+		uint8_t slot = sequence_arg_count? sequence_args[0] : sequence_frame_count();
+		uint8_t reply[] = {0xF0, 0x1F, SEQUENCE_CMD_SNAPSHOT, slot & 0x7F, sequence_snapshot(slot), 0xF7};
+		midi_stream_sysex(sizeof(reply), reply);
+		break;
+	}
+	default:
+		break;
+	}
+	sequence_command = SEQUENCE_CMD_NONE;
+}
+
+void sequence_play(uint8_t mode, uint8_t fps) {
+	if (mode != SEQUENCE_ONE_SHOT && mode != SEQUENCE_LOOP) {
+		sequence_stop();
+		return;
+	}
+	sequence_mode = mode;
+	sequence_fps = fps;
+	sequence_interval = fps? 1000 / fps : 1;
+	sequence_pos = sequence_first = 0;
+	sequence_end = 0xFFFF;
+	sequence_last = sequence_now() - sequence_interval; // first frame right away
+}
+
+void sequence_stop(void) {
+	sequence_mode = SEQUENCE_STOPPED;
+}
+
+void sequence_rebase(uint16_t restart) {
+	if (sequence_fps == 0) sequence_last -= restart;
+}
+
+void sequence_tick(void) {
+	if (sequence_mode == SEQUENCE_STOPPED) return;
+
+	uint16_t now = sequence_now();
+	if ((uint16_t)(now - sequence_last) < sequence_interval) return;
+	// Keep a steady rate, but don't try to catch up after a long stall.
+	sequence_last += sequence_interval;
+	if ((uint16_t)(now - sequence_last) >= sequence_interval) sequence_last = now;
+
+	uint16_t end = sequence_end < sequence_length? sequence_end : sequence_length;
+	if (sequence_pos >= end) {
+		if (sequence_mode == SEQUENCE_LOOP && sequence_first < end) {
+			sequence_pos = sequence_first;
+		} else {
+			sequence_stop();
+			return;
+		}
+	}
+
+	sequence_draw(sequence_pos);
+	sequence_pos += sequence_store[sequence_pos] + 1;
+}
+
+#endif // ENABLE_SEQUENCES
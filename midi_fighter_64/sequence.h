@@ -0,0 +1,53 @@
+ /* sequence.h
+ * DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#ifndef _SEQUENCE_H_INCLUDED
+#define _SEQUENCE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "constants.h"
+
+// Playback modes
+#define SEQUENCE_STOPPED    0
+#define SEQUENCE_ONE_SHOT   1
+#define SEQUENCE_LOOP       2
+
+// Snapshot replies
+#define SEQUENCE_SNAPSHOT_OK    0
+#define SEQUENCE_SNAPSHOT_FULL  1   // no room in the store, nothing changed
+
+// Lighting SysEx 0x1F: one data byte at a time, then the end of the message.
+extern void sequence_sysex_begin(void);
+
+extern void sequence_sysex_byte(uint8_t v);
+
+extern void sequence_sysex_end(void);
+
+extern void sequence_play(uint8_t mode, uint8_t fps);
+
+extern void sequence_stop(void);
+
+// display_flash_counter is about to go from 'restart' back to 0 (MIDI clock
+// start): keep a beat-timed sequence on its step.
+extern void sequence_rebase(uint16_t restart);
+
+// Once per frame: draw the next stored frame when it is due.
+extern void sequence_tick(void);
+
+#endif // _SEQUENCE_H_INCLUDED
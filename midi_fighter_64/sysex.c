@@ -27,6 +27,7 @@
 
 #include "led.h"
 #include "fastrgb.h"
+#include "sequence.h"
 #include <util/delay.h>
 
 uint8_t sysex_buffer[MIDI_MAX_SYSEX];
@@ -38,22 +39,45 @@ enum {
     // Different types of messages to handle
     State_NonRealtime,  // Non Realtime Sysex message
     State_DJTT,         // Manufacturer ID verified as DJTT manufacturer ID
+	// Streamed lighting messages, keep these last (see SYSEX_IS_STREAMING)
 	State_6F,
-	State_5F
+	State_5F,
+	State_4F,
+	State_3F,
+	State_2F,
+	State_1F,
+	State_0F
 } sysex_state = State_Begin;
 
 #define MAX_COMMAND 8
 SysExFn sysExCommandMap[MAX_COMMAND] = {0,};
 
+// Lighting messages (0x0F..0x6F) never touch sysex_buffer: their bytes go
+// straight to the fastrgb stream decoder (or the sequence store) as each
+// packet arrives.
+#define SYSEX_IS_STREAMING() (sysex_state >= State_6F)
+
+static void sysex_stream_byte (uint8_t v)
+{
+#if ENABLE_SEQUENCES > 0
+    if (sysex_state == State_1F) {
+        sequence_sysex_byte(v);
+        return;
+    }
+#endif
+    fastrgb_stream_byte(v);
+}
+
+static void sysex_stream_end (void)
+{
+#if ENABLE_SEQUENCES > 0
+    if (sysex_state == State_1F) sequence_sysex_end();
+#endif
+}
+
 void sysex_handle (uint16_t length)
 {   
-	if (sysex_state == State_5F) {
-		fastrgb_decompress(sysex_buffer, sysex_buffer + length - 1);
-	}
-	else if (sysex_state == State_6F) {
-        fastrgb_list(sysex_buffer, sysex_buffer + length - 1);
-	}
-    else if (sysex_state == State_DJTT && length > 0) {
+    if (sysex_state == State_DJTT && length > 0) {
         // This is a DJTT SysEx message
         
         // First byte is the command byte
@@ -123,16 +147,52 @@ void sysex_handle_3sc (MIDI_EventPacket_t* packet)
             sysex_state = State_CheckMID;
 
         } else if (packet->Data1 == 0xf0 &&
-				   packet->Data2 == 0x6f &&
-				   (sysex_ptr + 1) < buffer_end) {
+				   packet->Data2 == 0x6f) {
 			sysex_state = State_6F;
-			*sysex_ptr++ = packet->Data3;
+			fastrgb_stream_begin(FASTRGB_STREAM_LIST);
+			fastrgb_stream_byte(packet->Data3);
 
         } else if (packet->Data1 == 0xf0 &&
-				   packet->Data2 == 0x5f &&
-				   (sysex_ptr + 1) < buffer_end) {
+				   packet->Data2 == 0x5f) {
 			sysex_state = State_5F;
-			*sysex_ptr++ = packet->Data3;
+			fastrgb_stream_begin(FASTRGB_STREAM_COMPRESSED);
+			fastrgb_stream_byte(packet->Data3);
+
+        } else if (packet->Data1 == 0xf0 &&
+				   packet->Data2 == 0x4f) {
+			sysex_state = State_4F;
+			fastrgb_stream_begin(FASTRGB_STREAM_BITMAP);
+			fastrgb_stream_byte(packet->Data3);
+
+        } else if (packet->Data1 == 0xf0 &&
+				   packet->Data2 == 0x3f) {
+			sysex_state = State_3F;
+			fastrgb_stream_begin(FASTRGB_STREAM_INDEXED);
+			fastrgb_stream_byte(packet->Data3);
+
+#if ENABLE_PAD_FADES > 0
+        } else if (packet->Data1 == 0xf0 &&
+				   packet->Data2 == 0x2f) {
+			sysex_state = State_2F;
+			fastrgb_stream_begin(FASTRGB_STREAM_FADE);
+			fastrgb_stream_byte(packet->Data3);
+#endif
+
+#if ENABLE_SEQUENCES > 0
+        } else if (packet->Data1 == 0xf0 &&
+				   packet->Data2 == 0x1f) {
+			sysex_state = State_1F;
+			sequence_sysex_begin();
+			sequence_sysex_byte(packet->Data3);
+#endif
+
+#if ENABLE_GRID_TRANSFORMS > 0
+        } else if (packet->Data1 == 0xf0 &&
+				   packet->Data2 == 0x0f) {
+			sysex_state = State_0F;
+			fastrgb_stream_begin(FASTRGB_STREAM_TRANSFORM);
+			fastrgb_stream_byte(packet->Data3);
+#endif
 		
         } else {
             // Its not for us
@@ -158,6 +218,14 @@ void sysex_handle_3sc (MIDI_EventPacket_t* packet)
         // Sysex continues with three new bytes.
         if (sysex_state == State_Invalid) return; // Ignore until we get an end
         
+        if (SYSEX_IS_STREAMING()) {
+            // No length limit: decode and apply immediately.
+            sysex_stream_byte(packet->Data1);
+            sysex_stream_byte(packet->Data2);
+            sysex_stream_byte(packet->Data3);
+            return;
+        }
+
         // check bounds before inserting anything.
         if ( (sysex_ptr + 3) < buffer_end ) {
             *sysex_ptr++ = packet->Data1;
@@ -191,6 +259,11 @@ void sysex_handle_3e (MIDI_EventPacket_t* packet)
                 // Process the message
                 sysex_handle((uint16_t)(sysex_ptr - sysex_buffer));
             }
+        } else if (SYSEX_IS_STREAMING()) {
+            // Data3 is the 0xF7 terminator
+            sysex_stream_byte(packet->Data1);
+            sysex_stream_byte(packet->Data2);
+            sysex_stream_end();
         } else if (sysex_state != State_Invalid) {
             // check for buffer overflow
             if (sysex_ptr + 3 < buffer_end) {
@@ -221,7 +294,11 @@ void sysex_handle_2e (MIDI_EventPacket_t* packet)
 	if (sysex_is_reading) {
         sysex_is_reading = false;
         
-        if (sysex_state != State_Invalid) {
+        if (SYSEX_IS_STREAMING()) {
+            // Data2 is the 0xF7 terminator
+            sysex_stream_byte(packet->Data1);
+            sysex_stream_end();
+        } else if (sysex_state != State_Invalid) {
             // check for buffer overflow
             if (sysex_ptr + 2 < buffer_end) {
                 // NOTE: always going to be 0xF7 - so why bother?
@@ -248,7 +325,10 @@ void sysex_handle_1e (MIDI_EventPacket_t* packet)
         // finished reading sysex
         sysex_is_reading = false;
         
-        if (sysex_state != State_Invalid) {
+        if (SYSEX_IS_STREAMING()) {
+            // Only the 0xF7 terminator
+            sysex_stream_end();
+        } else if (sysex_state != State_Invalid) {
             // check for buffer overflow
             if (sysex_ptr + 1 < buffer_end) {
                 // NOTE: always going to be 0xF7 - so why bother?
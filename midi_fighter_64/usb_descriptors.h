@@ -41,6 +41,13 @@
 // packets.
 #define MIDI_STREAM_EPSIZE 64
 
+// Number of hardware banks for each MIDI stream endpoint. With two banks
+// (ping-pong) the controller can accept the next OUT packet from the host,
+// or send the previous IN packet to it, while the firmware is still working
+// on the other bank. Both endpoints together use 4 * 64 = 256 bytes of the
+// ATmega32U4's 832 byte endpoint DPRAM.
+#define MIDI_STREAM_BANKS 2
+
 
 // USB Descriptor -------------------------------------------------------------
 